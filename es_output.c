@@ -1,8 +1,13 @@
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
 
 #include "print_out.h"
 #include "es_output.h"
+#include "shm_ring.h"
 
 #define PES_START_CODE      0x000001
 
@@ -20,12 +25,46 @@
 #define PES_PTS_ONLY        0x02
 #define PES_PTS_DTS         0x03
 
+#define SHM_PREFIX          "shm://"
+#define SHM_RING_SIZE       (16 * 1024 * 1024)
+
+#define LATENCY_BUCKETS     272                  // 8 buckets per power of two up to 2^36 us
+
 typedef struct _ES_OUTPUT {
     const char*    pFileName;
     FILE*          pFile;
     ES_OUTPUT_TYPE eType;
     unsigned int   uPacketsNum;
     unsigned int   uContinuity;
+    unsigned int   uLive;
+    unsigned int   uErrorsNum;
+
+    P_PES_POOL     pPool;
+    unsigned char* pUnit;
+    unsigned int   uUnitPID;
+    unsigned int   uUnitLen;
+    unsigned int   uUnitSize;
+    unsigned int   uUnitExpected;
+    unsigned int   uUnitHint;
+
+    P_SHM_RING         pRing;
+    unsigned int       uRingFlags;
+    unsigned long long lluPTS;
+    unsigned long long lluDTS;
+
+    ES_FLUSH_POLICY    eFlush;
+    unsigned int       uFlushValue;
+    unsigned int       uPendingLen;
+    unsigned long long lluPendingTime;
+    unsigned long long lluArrival;
+    unsigned long long lluUnitArrival;
+    unsigned int       uStreamExpected;
+    unsigned int       uStreamLen;
+
+    unsigned long long lluLatencyNum;
+    unsigned long long lluLatencyMax;
+    unsigned int*      pLatency;
+    char*              pFileBuffer;
 } ES_OUTPUT;
 
 static const char pStrEmpty[] = "";
@@ -37,6 +76,73 @@ static const char* pStrOutputType[ES_OUTPUT_MAX_NUM] = {
     pStrAudio  // ES_OUTPUT_AUDIO
 };
 
+static unsigned long long _es_output_now(void)
+{
+    struct timespec tNow;
+
+    clock_gettime(CLOCK_MONOTONIC, &tNow);
+
+    return (unsigned long long) tNow.tv_sec * 1000000000LLU + tNow.tv_nsec;
+}
+
+static unsigned int _es_output_latency_bucket(unsigned long long lluMicro)
+{
+    // Values below 16 us have own buckets, larger ones are split into 8 buckets per power of two (12.5% precision)
+    if (lluMicro < 16)
+        return (unsigned int) lluMicro;
+
+    if (lluMicro >= (1LLU << 36))
+        return LATENCY_BUCKETS - 1;
+
+    unsigned int uPower = 63 - __builtin_clzll(lluMicro);
+
+    return 16 + (uPower - 4) * 8 + (unsigned int) ((lluMicro >> (uPower - 3)) & 7);
+}
+
+static unsigned int _es_output_latency_value(unsigned int uBucket)
+{
+    // Upper bound of the bucket
+    if (uBucket < 16)
+        return uBucket;
+
+    unsigned int       uPower = 4 + (uBucket - 16) / 8;
+    unsigned long long lluMax = ((8LLU + (uBucket - 16) % 8 + 1) << (uPower - 3)) - 1;
+
+    return (lluMax > UINT_MAX) ? UINT_MAX : (unsigned int) lluMax;
+}
+
+static void _es_output_latency_add(ES_OUTPUT* pEsOutput, unsigned long long lluLatency)
+{
+    unsigned long long lluMicro = lluLatency / 1000;
+
+    if (! pEsOutput->pLatency)
+        return;
+
+    pEsOutput->pLatency[_es_output_latency_bucket(lluMicro)] += 1;
+    pEsOutput->lluLatencyNum += 1;
+
+    if (lluMicro > pEsOutput->lluLatencyMax)
+        pEsOutput->lluLatencyMax = lluMicro;
+}
+
+static int _es_output_sync(ES_OUTPUT* pEsOutput, unsigned int uForced)
+{
+    if (! pEsOutput->uPendingLen)
+        return EXIT_SUCCESS;
+
+    // Buffered data is passed to the system, latency is counted from arrival of its oldest byte.
+    // Forced flush (idle input, end of stream) is not a result of the policy and is not counted.
+    if ((pEsOutput->pFile) && (fflush(pEsOutput->pFile) != 0))
+        return EXIT_FAILURE;
+
+    if (! uForced)
+        _es_output_latency_add(pEsOutput, _es_output_now() - pEsOutput->lluPendingTime);
+
+    pEsOutput->uPendingLen = 0;
+
+    return EXIT_SUCCESS;
+}
+
 P_ES_OUTPUT es_output_create(const char* pFileName, ES_OUTPUT_TYPE eType)
 {
     if ((eType < ES_OUTPUT_VIDEO)
@@ -56,6 +162,47 @@ P_ES_OUTPUT es_output_create(const char* pFileName, ES_OUTPUT_TYPE eType)
     pEsOutput->eType       = eType;
     pEsOutput->uPacketsNum = 0;
     pEsOutput->uContinuity = 0;
+    pEsOutput->uLive       = 0;
+    pEsOutput->uErrorsNum  = 0;
+
+    pEsOutput->pPool         = BAD_PES_POOL;
+    pEsOutput->pUnit         = NULL;
+    pEsOutput->uUnitPID      = 0;
+    pEsOutput->uUnitLen      = 0;
+    pEsOutput->uUnitSize     = 0;
+    pEsOutput->uUnitExpected = 0;
+    pEsOutput->uUnitHint     = 0;
+
+    pEsOutput->pRing         = BAD_SHM_RING;
+    pEsOutput->uRingFlags    = 0;
+    pEsOutput->lluPTS        = 0;
+    pEsOutput->lluDTS        = 0;
+
+    pEsOutput->eFlush          = ES_FLUSH_NONE;
+    pEsOutput->uFlushValue     = 0;
+    pEsOutput->uPendingLen     = 0;
+    pEsOutput->lluPendingTime  = 0;
+    pEsOutput->lluArrival      = 0;
+    pEsOutput->lluUnitArrival  = 0;
+    pEsOutput->uStreamExpected = 0;
+    pEsOutput->uStreamLen      = 0;
+
+    pEsOutput->lluLatencyNum   = 0;
+    pEsOutput->lluLatencyMax   = 0;
+    pEsOutput->pLatency        = NULL;
+    pEsOutput->pFileBuffer     = NULL;
+
+    // Payload and PES metadata are published to shared memory instead of file
+    if (! strncmp(pFileName, SHM_PREFIX, strlen(SHM_PREFIX)))
+    {
+        pEsOutput->pRing = shm_ring_create(pFileName + strlen(SHM_PREFIX), SHM_RING_SIZE);
+
+        if (pEsOutput->pRing == BAD_SHM_RING)
+        {
+            free(pEsOutput);
+            return BAD_ES_OUTPUT;
+        }
+    }
 
     // Return the pointer to description struct
     return (P_ES_OUTPUT) pEsOutput;
@@ -67,13 +214,319 @@ void es_output_free(P_ES_OUTPUT pOutput)
 
     if (pEsOutput)
     {
+        // The last PES ends with the stream
+        es_output_flush(pOutput);
+        _es_output_sync(pEsOutput, 1);
+
         if (pEsOutput->pFile)
             fclose(pEsOutput->pFile);
 
+        // Buffer is used by stdio until the file is closed
+        if (pEsOutput->pFileBuffer)
+            free(pEsOutput->pFileBuffer);
+
+        if (pEsOutput->pLatency)
+        {
+            unsigned int uP50, uP90, uP99, uMax;
+
+            if (es_output_get_latency(pOutput, &uP50, &uP90, &uP99, &uMax) == EXIT_SUCCESS)
+                OUT("%s output latency : p50 %u us, p90 %u us, p99 %u us, max %u us (%llu samples)\n",
+                    pStrOutputType[pEsOutput->eType], uP50, uP90, uP99, uMax, pEsOutput->lluLatencyNum);
+
+            free(pEsOutput->pLatency);
+        }
+
+        if (pEsOutput->pRing != BAD_SHM_RING)
+            shm_ring_free(pEsOutput->pRing);
+
         free(pEsOutput);
     }
 }
 
+static int _es_output_parse_header(ES_OUTPUT* pEsOutput, unsigned char** ppData, unsigned int* pLength, unsigned int uPID)
+{
+    unsigned char* pData   = *ppData;
+    unsigned int   uLength = *pLength;
+
+    unsigned int  uStartCode  =  pData[0]         << 16;
+                  uStartCode |=  pData[1]         << 8;
+                  uStartCode |=  pData[2];
+    unsigned char uStreamID   =  pData[3];
+//  unsigned int  uPacketLen  =  pData[4]         << 8;
+//                uPacketLen |=  pData[5];
+    unsigned char uMarker     = (pData[6] & 0xC0) >> 6; // Must be equal to 0x02
+//  unsigned char uScrambling = (pData[6] & 0x30) >> 4;
+//  unsigned char uPriority   = (pData[6] & 0x08) >> 3;
+//  unsigned char uAlignment  = (pData[6] & 0x04) >> 2;
+//  unsigned char uCopyright  = (pData[6] & 0x02) >> 1;
+//  unsigned char uOriginal   = (pData[6] & 0x01);
+    unsigned char uPTS_DTS    = (pData[7] & 0xC0) >> 6;
+//  unsigned char uESCR       = (pData[7] & 0x20) >> 5;
+//  unsigned char uEsRate     = (pData[7] & 0x10) >> 4;
+//  unsigned char uDsmTrick   = (pData[7] & 0x08) >> 3;
+//  unsigned char uCopyInfo   = (pData[7] & 0x04) >> 2;
+//  unsigned char uCRC        = (pData[7] & 0x02) >> 1;
+//  unsigned char uExtension  = (pData[7] & 0x01);
+    unsigned char uHeaderLen  =  pData[8];
+
+    pData   += 9;
+    uLength -= 9;
+
+    if (uStartCode != PES_START_CODE)
+    {
+        ERR("PID %u : Incorrect start code (%06X)\n", uPID, uStartCode);
+        return EXIT_FAILURE;
+    }
+
+    if ((pEsOutput->eType == ES_OUTPUT_VIDEO)
+    && ((uStreamID < STREAM_ID_VIDEO_MIN)
+    ||  (uStreamID > STREAM_ID_VIDEO_MAX)))
+    {
+        ERR("PID %u : Incorrect stream ID (%02X)\n", uPID, uStreamID);
+        return EXIT_FAILURE;
+    }
+
+    if ((pEsOutput->eType == ES_OUTPUT_AUDIO)
+    &&  (uStreamID != STREAM_ID_PRIVATE_1)
+    && ((uStreamID  < STREAM_ID_AUDIO_MIN)
+    ||  (uStreamID  > STREAM_ID_AUDIO_MAX)))
+    {
+        ERR("PID %u : Incorrect stream ID (%02X)\n", uPID, uStreamID);
+        return EXIT_FAILURE;
+    }
+
+    if ((uMarker != 0x02)
+    ||  (uHeaderLen > uLength))
+    {
+        ERR("PID %u : Incorrect PES header\n", uPID);
+        return EXIT_FAILURE;
+    }
+
+    // Metadata of the unit for shared memory output
+    pEsOutput->uRingFlags = SHM_RING_FLAG_UNIT_START | (pEsOutput->uRingFlags & SHM_RING_FLAG_LOSS);
+
+    // Parse PES header extensions
+    if (((uPTS_DTS == PES_PTS_ONLY) || (uPTS_DTS == PES_PTS_DTS)) && (uHeaderLen > 4))
+    {
+        unsigned long long lluPTS_90kHz = 0LLU;
+        unsigned long long lluDTS_90kHz = 0LLU;
+
+        // 33-bit PTS
+        lluPTS_90kHz  = (pData[0] >> 1) & 0x07; lluPTS_90kHz <<= 8;
+        lluPTS_90kHz |=  pData[1];              lluPTS_90kHz <<= 7;
+        lluPTS_90kHz |= (pData[2] >> 1);        lluPTS_90kHz <<= 8;
+        lluPTS_90kHz |=  pData[3];              lluPTS_90kHz <<= 7;
+        lluPTS_90kHz |= (pData[4] >> 1);
+
+        // 33-bit DTS
+        lluDTS_90kHz = lluPTS_90kHz;
+
+        if ((uPTS_DTS == PES_PTS_DTS) && (uHeaderLen > 9))
+        {
+            lluDTS_90kHz  = (pData[5] >> 1) & 0x07; lluDTS_90kHz <<= 8;
+            lluDTS_90kHz |=  pData[6];              lluDTS_90kHz <<= 7;
+            lluDTS_90kHz |= (pData[7] >> 1);        lluDTS_90kHz <<= 8;
+            lluDTS_90kHz |=  pData[8];              lluDTS_90kHz <<= 7;
+            lluDTS_90kHz |= (pData[9] >> 1);
+        }
+
+        pEsOutput->uRingFlags |= SHM_RING_FLAG_PTS | ((uPTS_DTS == PES_PTS_DTS) ? SHM_RING_FLAG_DTS : 0);
+        pEsOutput->lluPTS      = lluPTS_90kHz;
+        pEsOutput->lluDTS      = lluDTS_90kHz;
+
+        if (pEsOutput->uLive)
+            DBG("PID %u: %s frame, PTS %llu, DTS %llu\n", uPID, pStrOutputType[pEsOutput->eType], lluPTS_90kHz, lluDTS_90kHz);
+        else
+            OUT("PID %u: %s frame, PTS %llu, DTS %llu\n", uPID, pStrOutputType[pEsOutput->eType], lluPTS_90kHz, lluDTS_90kHz);
+    }
+
+    *ppData  = pData   + uHeaderLen;
+    *pLength = uLength - uHeaderLen;
+
+    return EXIT_SUCCESS;
+}
+
+static int _es_output_open(ES_OUTPUT* pEsOutput, const char* pMode)
+{
+    pEsOutput->pFile = fopen(pEsOutput->pFileName, pMode);
+
+    if (! pEsOutput->pFile)
+        return EXIT_FAILURE;
+
+    // Buffer holds the whole threshold, otherwise stdio writes out earlier
+    if ((pEsOutput->pFileBuffer) && (setvbuf(pEsOutput->pFile, pEsOutput->pFileBuffer, _IOFBF, pEsOutput->uFlushValue) != 0))
+        return EXIT_FAILURE;
+
+    return EXIT_SUCCESS;
+}
+
+static int _es_output_write(ES_OUTPUT* pEsOutput, unsigned char* pData, unsigned int uLength, unsigned int uPID, unsigned long long lluArrival)
+{
+    if ((uLength > 0) && (pEsOutput->pRing != BAD_SHM_RING))
+    {
+        // Unit metadata goes with its first fragment only, published data is visible to readers at once
+        int nResult = shm_ring_write(pEsOutput->pRing, uPID, pEsOutput->uRingFlags, pEsOutput->lluPTS, pEsOutput->lluDTS, pData, uLength);
+
+        if (pEsOutput->eFlush != ES_FLUSH_NONE)
+            _es_output_latency_add(pEsOutput, _es_output_now() - lluArrival);
+
+        pEsOutput->uRingFlags = 0;
+        return nResult;
+    }
+
+    if (uLength > 0)
+    {
+        if ((! pEsOutput->pFile) && (_es_output_open(pEsOutput, "wb") != EXIT_SUCCESS))
+            return EXIT_FAILURE;
+
+        fwrite(pData, 1, uLength, pEsOutput->pFile);
+
+        if (pEsOutput->eFlush != ES_FLUSH_NONE)
+        {
+            if (! pEsOutput->uPendingLen)
+                pEsOutput->lluPendingTime = lluArrival;
+
+            pEsOutput->uPendingLen += uLength;
+
+            // Arrival of the current packet is used as the current time.
+            // Without polling (file input) the deadline is checked only here and at the end of input.
+            if (((pEsOutput->eFlush == ES_FLUSH_BYTES)    && (pEsOutput->uPendingLen >= pEsOutput->uFlushValue))
+            ||  ((pEsOutput->eFlush == ES_FLUSH_DEADLINE) && ((pEsOutput->lluArrival - pEsOutput->lluPendingTime) >= pEsOutput->uFlushValue * 1000000LLU)))
+                return _es_output_sync(pEsOutput, 0);
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
+
+static int _es_output_write_unit(ES_OUTPUT* pEsOutput, unsigned char* pUnit, unsigned int uLength, unsigned int uPID, unsigned long long lluArrival)
+{
+    // Whole PES: header is parsed and payload is written at once
+    if (uLength <= 9)
+    {
+        ERR("PID %u : Incorrect PES length (%u bytes)\n", uPID, uLength);
+        return EXIT_FAILURE;
+    }
+
+    if (_es_output_parse_header(pEsOutput, &pUnit, &uLength, uPID) != EXIT_SUCCESS)
+        return EXIT_FAILURE;
+
+    pEsOutput->uRingFlags |= SHM_RING_FLAG_UNIT_END;
+
+    if (_es_output_write(pEsOutput, pUnit, uLength, uPID, lluArrival) != EXIT_SUCCESS)
+        return EXIT_FAILURE;
+
+    return (pEsOutput->eFlush == ES_FLUSH_UNIT) ? _es_output_sync(pEsOutput, 0) : EXIT_SUCCESS;
+}
+
+static void _es_output_drop_unit(ES_OUTPUT* pEsOutput)
+{
+    if (pEsOutput->pUnit)
+        pes_pool_put(pEsOutput->pPool, pEsOutput->pUnit);
+
+    pEsOutput->pUnit         = NULL;
+    pEsOutput->uUnitLen      = 0;
+    pEsOutput->uUnitSize     = 0;
+    pEsOutput->uUnitExpected = 0;
+}
+
+static int _es_output_end_unit(ES_OUTPUT* pEsOutput)
+{
+    int nResult = EXIT_SUCCESS;
+
+    if (pEsOutput->pUnit)
+    {
+        // Buffer goes back to the pool as soon as the unit is consumed
+        nResult = _es_output_write_unit(pEsOutput, pEsOutput->pUnit, pEsOutput->uUnitLen, pEsOutput->uUnitPID, pEsOutput->lluUnitArrival);
+
+        pEsOutput->uUnitHint = pEsOutput->uUnitLen;
+        _es_output_drop_unit(pEsOutput);
+    }
+
+    return nResult;
+}
+
+static int _es_output_append_unit(ES_OUTPUT* pEsOutput, unsigned char* pData, unsigned int uLength)
+{
+    if ((pEsOutput->uUnitLen + uLength) > pEsOutput->uUnitSize)
+    {
+        // Next size class from the pool, the current buffer is recycled
+        unsigned int   uSize = 0;
+        unsigned char* pUnit = pes_pool_get(pEsOutput->pPool, pEsOutput->uUnitLen + uLength, &uSize);
+
+        if (! pUnit)
+            return EXIT_FAILURE;
+
+        if (pEsOutput->pUnit)
+        {
+            memcpy(pUnit, pEsOutput->pUnit, pEsOutput->uUnitLen);
+            pes_pool_put(pEsOutput->pPool, pEsOutput->pUnit);
+        }
+
+        pEsOutput->pUnit     = pUnit;
+        pEsOutput->uUnitSize = uSize;
+    }
+
+    memcpy(pEsOutput->pUnit + pEsOutput->uUnitLen, pData, uLength);
+    pEsOutput->uUnitLen += uLength;
+
+    return EXIT_SUCCESS;
+}
+
+static int _es_output_reassemble(ES_OUTPUT* pEsOutput, unsigned char* pData, unsigned int uLength, unsigned int uPID, unsigned int uUnitStart)
+{
+    if (uUnitStart)
+    {
+        // Previous PES is complete
+        if (_es_output_end_unit(pEsOutput) != EXIT_SUCCESS)
+            return EXIT_FAILURE;
+
+        // PES_packet_length (0 means unbounded video PES)
+        unsigned int uExpected = 0;
+
+        if (uLength > 5)
+        {
+            uExpected = (pData[4] << 8) | pData[5];
+            uExpected = uExpected ? (6 + uExpected) : 0;
+        }
+
+        // Single-packet PES is written right from the packet without copying
+        if ((uExpected > 0) && (uExpected <= uLength))
+            return _es_output_write_unit(pEsOutput, pData, uExpected, uPID, pEsOutput->lluArrival);
+
+        // Buffer for the whole PES, size of unbounded one is guessed from the previous PES
+        unsigned int uSize = uExpected ? uExpected : ((pEsOutput->uUnitHint > uLength) ? pEsOutput->uUnitHint : uLength);
+
+        pEsOutput->pUnit = pes_pool_get(pEsOutput->pPool, uSize, &pEsOutput->uUnitSize);
+
+        if (! pEsOutput->pUnit)
+            return EXIT_FAILURE;
+
+        pEsOutput->uUnitPID       = uPID;
+        pEsOutput->uUnitLen       = 0;
+        pEsOutput->uUnitExpected  = uExpected;
+        pEsOutput->lluUnitArrival = pEsOutput->lluArrival;
+    }
+    else if (! pEsOutput->pUnit)
+    {
+        // Data before the first PES start cannot make a whole unit
+        DBG("PID %u : %u bytes without PES start are skipped\n", uPID, uLength);
+        return EXIT_SUCCESS;
+    }
+
+    if (_es_output_append_unit(pEsOutput, pData, uLength) != EXIT_SUCCESS)
+        return EXIT_FAILURE;
+
+    // Bounded PES is complete as soon as all its bytes are collected
+    if ((pEsOutput->uUnitExpected > 0) && (pEsOutput->uUnitLen >= pEsOutput->uUnitExpected))
+    {
+        pEsOutput->uUnitLen = pEsOutput->uUnitExpected;
+        return _es_output_end_unit(pEsOutput);
+    }
+
+    return EXIT_SUCCESS;
+}
+
 int es_output_parse_pes(P_ES_OUTPUT pOutput, unsigned char* pData, unsigned int uLength, unsigned int uPID, unsigned int uUnitStart, unsigned int uContinuity)
 {
     ES_OUTPUT* pEsOutput = (ES_OUTPUT*) pOutput;
@@ -81,116 +534,298 @@ int es_output_parse_pes(P_ES_OUTPUT pOutput, unsigned char* pData, unsigned int
     if (! pEsOutput)
         return EXIT_FAILURE;
 
+    // Arrival time of the packet for latency measurement
+    if (pEsOutput->eFlush != ES_FLUSH_NONE)
+        pEsOutput->lluArrival = _es_output_now();
+
     // Continuity counter checking
     if ((pEsOutput->uPacketsNum > 0) && (uContinuity != ((pEsOutput->uContinuity + 1) & 0x0F)))
     {
-        ERR("PID %u : Incorrect continuity value (%u)\n", uPID, uContinuity);
-        return EXIT_FAILURE;
-    }
-
-    // Parse PES header
-    if ((uUnitStart) && (uLength > 9))
-    {
-        unsigned int  uStartCode  =  pData[0]         << 16;
-                      uStartCode |=  pData[1]         << 8;
-                      uStartCode |=  pData[2];
-        unsigned char uStreamID   =  pData[3];
-//      unsigned int  uPacketLen  =  pData[4]         << 8;
-//                    uPacketLen |=  pData[5];
-        unsigned char uMarker     = (pData[6] & 0xC0) >> 6; // Must be equal to 0x02
-//      unsigned char uScrambling = (pData[6] & 0x30) >> 4;
-//      unsigned char uPriority   = (pData[6] & 0x08) >> 3;
-//      unsigned char uAlignment  = (pData[6] & 0x04) >> 2;
-//      unsigned char uCopyright  = (pData[6] & 0x02) >> 1;
-//      unsigned char uOriginal   = (pData[6] & 0x01);
-        unsigned char uPTS_DTS    = (pData[7] & 0xC0) >> 6;
-//      unsigned char uESCR       = (pData[7] & 0x20) >> 5;
-//      unsigned char uEsRate     = (pData[7] & 0x10) >> 4;
-//      unsigned char uDsmTrick   = (pData[7] & 0x08) >> 3;
-//      unsigned char uCopyInfo   = (pData[7] & 0x04) >> 2;
-//      unsigned char uCRC        = (pData[7] & 0x02) >> 1;
-//      unsigned char uExtension  = (pData[7] & 0x01);
-        unsigned char uHeaderLen  =  pData[8];
-
-        pData   += 9;
-        uLength -= 9;
-
-        if (uStartCode != PES_START_CODE)
+        if (! pEsOutput->uLive)
         {
-            ERR("PID %u : Incorrect start code (%06X)\n", uPID, uStartCode);
+            ERR("PID %u : Incorrect continuity value (%u)\n", uPID, uContinuity);
             return EXIT_FAILURE;
         }
 
-        if ((pEsOutput->eType == ES_OUTPUT_VIDEO)
-        && ((uStreamID < STREAM_ID_VIDEO_MIN)
-        ||  (uStreamID > STREAM_ID_VIDEO_MAX)))
-        {
-            ERR("PID %u : Incorrect stream ID (%02X)\n", uPID, uStreamID);
+        // Packets are lost in live stream, data is written as is from the next packet
+        DBG("PID %u : Incorrect continuity value (%u)\n", uPID, uContinuity);
+        pEsOutput->uErrorsNum += 1;
+        pEsOutput->uRingFlags |= SHM_RING_FLAG_LOSS;
+
+        // Incomplete PES is never passed on
+        _es_output_drop_unit(pEsOutput);
+    }
+
+    if (pEsOutput->pPool != BAD_PES_POOL)
+    {
+        // Collect whole PES
+        if (_es_output_reassemble(pEsOutput, pData, uLength, uPID, uUnitStart) != EXIT_SUCCESS)
             return EXIT_FAILURE;
+    }
+    else
+    {
+        if (uUnitStart)
+        {
+            // Previous PES is complete
+            if ((pEsOutput->eFlush == ES_FLUSH_UNIT) && (_es_output_sync(pEsOutput, 0) != EXIT_SUCCESS))
+                return EXIT_FAILURE;
+
+            // End of bounded PES is found by its length
+            pEsOutput->uStreamExpected = ((uLength > 5) && ((pData[4] << 8) | pData[5])) ? (6 + ((pData[4] << 8) | pData[5])) : 0;
+            pEsOutput->uStreamLen      = 0;
         }
 
-        if ((pEsOutput->eType == ES_OUTPUT_AUDIO)
-        &&  (uStreamID != STREAM_ID_PRIVATE_1)
-        && ((uStreamID  < STREAM_ID_AUDIO_MIN)
-        ||  (uStreamID  > STREAM_ID_AUDIO_MAX)))
-        {
-            ERR("PID %u : Incorrect stream ID (%02X)\n", uPID, uStreamID);
+        pEsOutput->uStreamLen += uLength;
+
+        // Parse PES header
+        if ((uUnitStart) && (uLength > 9) && (_es_output_parse_header(pEsOutput, &pData, &uLength, uPID) != EXIT_SUCCESS))
             return EXIT_FAILURE;
-        }
 
-        if ((uMarker != 0x02)
-        ||  (uHeaderLen > uLength))
+        // Write data
+        if (_es_output_write(pEsOutput, pData, uLength, uPID, pEsOutput->lluArrival) != EXIT_SUCCESS)
+            return EXIT_FAILURE;
+
+        if ((pEsOutput->eFlush == ES_FLUSH_UNIT)
+        &&  (pEsOutput->uStreamExpected > 0)
+        &&  (pEsOutput->uStreamLen >= pEsOutput->uStreamExpected)
+        &&  (_es_output_sync(pEsOutput, 0) != EXIT_SUCCESS))
+            return EXIT_FAILURE;
+    }
+
+    pEsOutput->uPacketsNum += 1;
+    pEsOutput->uContinuity  = uContinuity;
+
+    return EXIT_SUCCESS;
+}
+
+int es_output_get_state(P_ES_OUTPUT pOutput, unsigned int* pPacketsNum, unsigned int* pContinuity, unsigned long long* pLength, unsigned int* pPending)
+{
+    ES_OUTPUT* pEsOutput = (ES_OUTPUT*) pOutput;
+    off_t      nLength   = 0;
+
+    if (! pEsOutput)
+        return EXIT_FAILURE;
+
+    // All written data must reach the file before its length is reported
+    if (pEsOutput->pFile)
+    {
+        if (fflush(pEsOutput->pFile) != 0)
+            return EXIT_FAILURE;
+
+        nLength = ftello(pEsOutput->pFile);
+
+        if (nLength < 0)
+            return EXIT_FAILURE;
+    }
+
+    if (pPacketsNum) *pPacketsNum = pEsOutput->uPacketsNum;
+    if (pContinuity) *pContinuity = pEsOutput->uContinuity;
+    if (pLength)     *pLength     = (unsigned long long) nLength;
+    if (pPending)    *pPending    = pEsOutput->uUnitLen;
+
+    return EXIT_SUCCESS;
+}
+
+int es_output_set_state(P_ES_OUTPUT pOutput, unsigned int uPacketsNum, unsigned int uContinuity, unsigned long long lluLength)
+{
+    ES_OUTPUT* pEsOutput = (ES_OUTPUT*) pOutput;
+
+    if ((! pEsOutput) || (pEsOutput->pFile))
+        return EXIT_FAILURE;
+
+    // Existing output is reopened and cut to the saved length, empty output is created on the first write as usual
+    if (lluLength > 0)
+    {
+        if ((_es_output_open(pEsOutput, "r+b") != EXIT_SUCCESS)
+        ||  (fseeko(pEsOutput->pFile, 0, SEEK_END) < 0)
+        ||  ((unsigned long long) ftello(pEsOutput->pFile) < lluLength))
         {
-            ERR("PID %u : Incorrect PES header\n", uPID);
+            ERR("%s output file \"%s\" is shorter than %llu bytes\n", pStrOutputType[pEsOutput->eType], pEsOutput->pFileName, lluLength);
             return EXIT_FAILURE;
         }
 
-        // Parse PES header extensions
-        if (((uPTS_DTS == PES_PTS_ONLY) || (uPTS_DTS == PES_PTS_DTS)) && (uHeaderLen > 4))
-        {
-            unsigned long long lluPTS_90kHz = 0LLU;
-            unsigned long long lluDTS_90kHz = 0LLU;
-
-            // 33-bit PTS
-            lluPTS_90kHz  = (pData[0] >> 1) & 0x07; lluPTS_90kHz <<= 8;
-            lluPTS_90kHz |=  pData[1];              lluPTS_90kHz <<= 7;
-            lluPTS_90kHz |= (pData[2] >> 1);        lluPTS_90kHz <<= 8;
-            lluPTS_90kHz |=  pData[3];              lluPTS_90kHz <<= 7;
-            lluPTS_90kHz |= (pData[4] >> 1);
-
-            // 33-bit DTS
-            lluDTS_90kHz = lluPTS_90kHz;
-
-            if ((uPTS_DTS == PES_PTS_DTS) && (uHeaderLen > 9))
-            {
-                lluDTS_90kHz  = (pData[5] >> 1) & 0x07; lluDTS_90kHz <<= 8;
-                lluDTS_90kHz |=  pData[6];              lluDTS_90kHz <<= 7;
-                lluDTS_90kHz |= (pData[7] >> 1);        lluDTS_90kHz <<= 8;
-                lluDTS_90kHz |=  pData[8];              lluDTS_90kHz <<= 7;
-                lluDTS_90kHz |= (pData[9] >> 1);
-            }
+        if ((ftruncate(fileno(pEsOutput->pFile), (off_t) lluLength) < 0)
+        ||  (fseeko(pEsOutput->pFile, (off_t) lluLength, SEEK_SET) < 0))
+            return EXIT_FAILURE;
+    }
 
-            OUT("PID %u: %s frame, PTS %llu, DTS %llu\n", uPID, pStrOutputType[pEsOutput->eType], lluPTS_90kHz, lluDTS_90kHz);
-        }
+    // Streaming unit end is not saved, unit open at checkpoint is completed by the next unit start
+    pEsOutput->uStreamExpected = 0;
+    pEsOutput->uStreamLen      = 0;
+
+    pEsOutput->uPacketsNum = uPacketsNum;
+    pEsOutput->uContinuity = uContinuity;
+
+    return EXIT_SUCCESS;
+}
+
+int es_output_set_pool(P_ES_OUTPUT pOutput, P_PES_POOL pPool)
+{
+    ES_OUTPUT* pEsOutput = (ES_OUTPUT*) pOutput;
+
+    if ((! pEsOutput) || (pEsOutput->uPacketsNum > 0))
+        return EXIT_FAILURE;
+
+    pEsOutput->pPool = pPool;
+
+    return EXIT_SUCCESS;
+}
+
+int es_output_flush(P_ES_OUTPUT pOutput)
+{
+    ES_OUTPUT* pEsOutput = (ES_OUTPUT*) pOutput;
 
-        pData   += uHeaderLen;
-        uLength -= uHeaderLen;
+    if (! pEsOutput)
+        return EXIT_FAILURE;
+
+    return _es_output_end_unit(pEsOutput);
+}
+
+void es_output_set_live(P_ES_OUTPUT pOutput)
+{
+    ES_OUTPUT* pEsOutput = (ES_OUTPUT*) pOutput;
+
+    if (pEsOutput)
+        pEsOutput->uLive = 1;
+}
+
+int es_output_get_errors(P_ES_OUTPUT pOutput, unsigned int* pErrorsNum)
+{
+    ES_OUTPUT* pEsOutput = (ES_OUTPUT*) pOutput;
+
+    if (! pEsOutput)
+        return EXIT_FAILURE;
+
+    if (pErrorsNum) *pErrorsNum = pEsOutput->uErrorsNum;
+
+    return EXIT_SUCCESS;
+}
+
+int es_output_set_flush(P_ES_OUTPUT pOutput, ES_FLUSH_POLICY eFlush, unsigned int uValue)
+{
+    ES_OUTPUT* pEsOutput = (ES_OUTPUT*) pOutput;
+
+    if ((! pEsOutput) || (eFlush < ES_FLUSH_NONE) || (eFlush > ES_FLUSH_BYTES) || (pEsOutput->pFile))
+        return EXIT_FAILURE;
+
+    // Latency is measured only when some flush policy is set
+    if ((eFlush != ES_FLUSH_NONE) && (! pEsOutput->pLatency))
+    {
+        pEsOutput->pLatency = (unsigned int*) calloc(LATENCY_BUCKETS, sizeof(unsigned int));
+
+        if (! pEsOutput->pLatency)
+            return EXIT_FAILURE;
     }
 
-    // Write data
-    if (uLength > 0)
+    // stdio ignores the size of buffer it allocates itself, so byte threshold needs own buffer
+    free(pEsOutput->pFileBuffer);
+    pEsOutput->pFileBuffer = NULL;
+
+    if (eFlush == ES_FLUSH_BYTES)
     {
-        if (! pEsOutput->pFile)
-            pEsOutput->pFile = fopen(pEsOutput->pFileName, "wb");
+        pEsOutput->pFileBuffer = (char*) malloc(uValue);
 
-        if (! pEsOutput->pFile)
+        if (! pEsOutput->pFileBuffer)
             return EXIT_FAILURE;
+    }
 
-        fwrite(pData, 1, uLength, pEsOutput->pFile);
+    pEsOutput->eFlush      = eFlush;
+    pEsOutput->uFlushValue = uValue;
+
+    return EXIT_SUCCESS;
+}
+
+int es_output_poll(P_ES_OUTPUT pOutput, unsigned int uIdle, unsigned int* pTimeout)
+{
+    ES_OUTPUT*   pEsOutput = (ES_OUTPUT*) pOutput;
+    unsigned int uTimeout  = UINT_MAX;
+
+    if (! pEsOutput)
+        return EXIT_FAILURE;
+
+    // Buffered data is written out when input is idle or its deadline is reached
+    if ((pEsOutput->eFlush != ES_FLUSH_NONE) && (pEsOutput->uPendingLen > 0))
+    {
+        unsigned long long lluAge   = _es_output_now() - pEsOutput->lluPendingTime;
+        unsigned long long lluLimit = pEsOutput->uFlushValue * 1000000LLU;
+
+        unsigned int       uDue     = (pEsOutput->eFlush == ES_FLUSH_DEADLINE) && (lluAge >= lluLimit);
+
+        if ((uIdle) || (uDue))
+        {
+            if (_es_output_sync(pEsOutput, ! uDue) != EXIT_SUCCESS)
+                return EXIT_FAILURE;
+        }
+        else if (pEsOutput->eFlush == ES_FLUSH_DEADLINE)
+            uTimeout = (unsigned int) ((lluLimit - lluAge + 999999) / 1000000);
     }
 
-    pEsOutput->uPacketsNum += 1;
-    pEsOutput->uContinuity  = uContinuity;
+    if (pTimeout) *pTimeout = uTimeout;
+
+    return EXIT_SUCCESS;
+}
+
+int es_output_get_latency(P_ES_OUTPUT pOutput, unsigned int* pP50, unsigned int* pP90, unsigned int* pP99, unsigned int* pMax)
+{
+    ES_OUTPUT*         pEsOutput  = (ES_OUTPUT*) pOutput;
+    unsigned int       pValues[3] = { 0, 0, 0 };
+    unsigned int       pRanks[3]  = { 50, 90, 99 };
+    unsigned long long lluSum     = 0;
+    unsigned int       i, j;
+
+    if ((! pEsOutput) || (! pEsOutput->lluLatencyNum))
+        return EXIT_FAILURE;
+
+    // Percentiles are upper bounds of histogram buckets
+    for (i = 0, j = 0; (i < LATENCY_BUCKETS) && (j < 3); i ++)
+    {
+        lluSum += pEsOutput->pLatency[i];
+
+        for ( ; (j < 3) && ((lluSum * 100) >= (pEsOutput->lluLatencyNum * pRanks[j])); j ++)
+            pValues[j] = (_es_output_latency_value(i) < pEsOutput->lluLatencyMax) ? _es_output_latency_value(i) : (unsigned int) pEsOutput->lluLatencyMax;
+    }
+
+    if (pP50) *pP50 = pValues[0];
+    if (pP90) *pP90 = pValues[1];
+    if (pP99) *pP99 = pValues[2];
+    if (pMax) *pMax = (pEsOutput->lluLatencyMax > UINT_MAX) ? UINT_MAX : (unsigned int) pEsOutput->lluLatencyMax;
+
+    return EXIT_SUCCESS;
+}
+
+int es_output_parse_flush(const char* pSpec, ES_FLUSH_POLICY* pFlush, unsigned int* pValue)
+{
+    int nValue = 0;
+
+    // "none", "unit", "deadline:<ms>" or "bytes:<bytes>"
+    if (! pSpec)
+        return EXIT_FAILURE;
+
+    if (! strcmp(pSpec, "none"))
+    {
+        *pFlush = ES_FLUSH_NONE;
+        *pValue = 0;
+    }
+    else if (! strcmp(pSpec, "unit"))
+    {
+        *pFlush = ES_FLUSH_UNIT;
+        *pValue = 0;
+    }
+    else if ((sscanf(pSpec, "deadline:%d", &nValue) == 1) && (nValue > 0))
+    {
+        *pFlush = ES_FLUSH_DEADLINE;
+        *pValue = (unsigned int) nValue;
+    }
+    else if ((sscanf(pSpec, "bytes:%d", &nValue) == 1) && (nValue > 0))
+    {
+        *pFlush = ES_FLUSH_BYTES;
+        *pValue = (unsigned int) nValue;
+    }
+    else
+    {
+        ERR("Incorrect flush policy \"%s\"\n", pSpec);
+        return EXIT_FAILURE;
+    }
 
     return EXIT_SUCCESS;
 }
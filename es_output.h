@@ -1,6 +1,8 @@
 #ifndef __ES_OUTPUT_H__
 #define __ES_OUTPUT_H__
 
+#include "pes_pool.h"
+
 typedef void* P_ES_OUTPUT;
 
 #define BAD_ES_OUTPUT ((P_ES_OUTPUT) NULL)
@@ -11,6 +13,13 @@ typedef enum _ES_OUTPUT_TYPE {
     ES_OUTPUT_MAX_NUM
 } ES_OUTPUT_TYPE;
 
+typedef enum _ES_FLUSH_POLICY {
+    ES_FLUSH_NONE = 0,  // stdio buffering only
+    ES_FLUSH_UNIT,      // At the end of each PES
+    ES_FLUSH_DEADLINE,  // When the oldest buffered byte is older than the value (ms), file input checks it on new data and at its end only
+    ES_FLUSH_BYTES      // When the value of bytes is buffered
+} ES_FLUSH_POLICY;
+
 P_ES_OUTPUT es_output_create    (const char* pFileName, ES_OUTPUT_TYPE eType);
 void        es_output_free      (P_ES_OUTPUT pOutput);
 
@@ -21,6 +30,31 @@ int         es_output_parse_pes (P_ES_OUTPUT    pOutput,
                                  unsigned int   uUnitStart,
                                  unsigned int   uContinuity);
 
+int         es_output_get_state (P_ES_OUTPUT         pOutput,
+                                 unsigned int*       pPacketsNum,
+                                 unsigned int*       pContinuity,
+                                 unsigned long long* pLength,
+                                 unsigned int*       pPending);
+int         es_output_set_state (P_ES_OUTPUT         pOutput,
+                                 unsigned int        uPacketsNum,
+                                 unsigned int        uContinuity,
+                                 unsigned long long  lluLength);
+
+int         es_output_set_pool  (P_ES_OUTPUT pOutput, P_PES_POOL pPool);
+int         es_output_flush     (P_ES_OUTPUT pOutput);
+
+int         es_output_set_flush (P_ES_OUTPUT pOutput, ES_FLUSH_POLICY eFlush, unsigned int uValue);
+int         es_output_poll      (P_ES_OUTPUT pOutput, unsigned int uIdle, unsigned int* pTimeout);
+int         es_output_get_latency(P_ES_OUTPUT  pOutput,
+                                 unsigned int* pP50,
+                                 unsigned int* pP90,
+                                 unsigned int* pP99,
+                                 unsigned int* pMax);
+int         es_output_parse_flush(const char* pSpec, ES_FLUSH_POLICY* pFlush, unsigned int* pValue);
+
+void        es_output_set_live  (P_ES_OUTPUT pOutput);
+int         es_output_get_errors(P_ES_OUTPUT pOutput, unsigned int* pErrorsNum);
+
 const char* es_output_type_str  (ES_OUTPUT_TYPE eType);
 
 #endif // __ES_OUTPUT_H__
@@ -1,49 +1,532 @@
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 
 #include "print_out.h"
+#include "shm_ring.h"
 #include "ts_demuxer.h"
+#include "ts_playout.h"
+#include "ts_server.h"
+
+#define MAX_PIDS_NUM    0x2000
+#define CHECKPOINT_STEP (64 * 1024 * 1024)
+#define MAX_FOLLOW_TIME (24 * 60 * 60)
+#define MAX_LINE_LENGTH 4096
+#define PES_POOL_LIMIT  (64 * 1024 * 1024)
+#define PROBE_BUDGET    (4 * 1024 * 1024)
+#define PROBE_TIME      200
+#define SHM_OPEN_TIME   10000
+#define SHM_POLL_TIME   1
+
+// Flush policies of video and audio outputs ("-flush" option)
+static ES_FLUSH_POLICY pMainFlush     [ES_OUTPUT_MAX_NUM] = { ES_FLUSH_NONE, ES_FLUSH_NONE };
+static unsigned int    pMainFlushValue[ES_OUTPUT_MAX_NUM] = { 0, 0 };
+
+static int _main_parse_flush(const char* pSpec, ES_FLUSH_POLICY* pFlush, unsigned int* pValue)
+{
+    char  pVideoSpec[MAX_LINE_LENGTH];
+    char* pAudioSpec = NULL;
+
+    // "<policy>" for both outputs or "<video policy>,<audio policy>"
+    if (snprintf(pVideoSpec, sizeof(pVideoSpec), "%s", pSpec) >= (int) sizeof(pVideoSpec))
+        return EXIT_FAILURE;
+
+    pAudioSpec = strchr(pVideoSpec, ',');
+
+    if (pAudioSpec)
+        *pAudioSpec++ = '\0';
+    else
+        pAudioSpec = pVideoSpec;
+
+    if ((es_output_parse_flush(pVideoSpec, &pFlush[ES_OUTPUT_VIDEO], &pValue[ES_OUTPUT_VIDEO]) != EXIT_SUCCESS)
+    ||  (es_output_parse_flush(pAudioSpec, &pFlush[ES_OUTPUT_AUDIO], &pValue[ES_OUTPUT_AUDIO]) != EXIT_SUCCESS))
+        return EXIT_FAILURE;
+
+    return EXIT_SUCCESS;
+}
+
+static int _main_demux(const char*  pTsFileName,
+                       const char*  pVideoFileName,
+                       const char*  pAudioFileName,
+                       const char*  pCheckpointName,
+                       unsigned int uResume,
+                       unsigned int uFollowTimeout,
+                       unsigned int uPoolLimit)
+{
+    P_TS_DEMUXER pDemuxer = ts_demuxer_create(pTsFileName);
+
+    if (pDemuxer != BAD_TS_DEMUXER)
+    {
+        int nResult = EXIT_SUCCESS;
+
+        if (nResult == EXIT_SUCCESS)
+            nResult = ts_demuxer_add_output(pDemuxer, ES_OUTPUT_VIDEO, pVideoFileName);
+
+        if (nResult == EXIT_SUCCESS)
+            nResult = ts_demuxer_add_output(pDemuxer, ES_OUTPUT_AUDIO, pAudioFileName);
+
+        if ((nResult == EXIT_SUCCESS) && (uPoolLimit))
+            nResult = ts_demuxer_set_reassembly(pDemuxer, uPoolLimit);
+
+        if (nResult == EXIT_SUCCESS)
+            nResult = ts_demuxer_set_flush(pDemuxer, ES_OUTPUT_VIDEO, pMainFlush[ES_OUTPUT_VIDEO], pMainFlushValue[ES_OUTPUT_VIDEO]);
+
+        if (nResult == EXIT_SUCCESS)
+            nResult = ts_demuxer_set_flush(pDemuxer, ES_OUTPUT_AUDIO, pMainFlush[ES_OUTPUT_AUDIO], pMainFlushValue[ES_OUTPUT_AUDIO]);
+
+        if ((nResult == EXIT_SUCCESS) && (pCheckpointName))
+            nResult = ts_demuxer_set_checkpoint(pDemuxer, pCheckpointName, CHECKPOINT_STEP);
+
+        if ((nResult == EXIT_SUCCESS) && (uResume))
+            nResult = ts_demuxer_resume(pDemuxer);
+
+        if ((nResult == EXIT_SUCCESS) && (uFollowTimeout))
+            nResult = ts_demuxer_set_follow(pDemuxer, uFollowTimeout);
+
+        if (nResult == EXIT_SUCCESS)
+            nResult = ts_demuxer_start(pDemuxer);
+
+        ts_demuxer_free(pDemuxer);
+        return nResult;
+    }
+
+    return EXIT_FAILURE;
+}
+
+static int _main_scan(const char* pTsFileName)
+{
+    P_TS_DEMUXER pDemuxer = ts_demuxer_create(pTsFileName);
+
+    if (pDemuxer != BAD_TS_DEMUXER)
+    {
+        int nResult = ts_demuxer_scan(pDemuxer);
+
+        ts_demuxer_free(pDemuxer);
+        return nResult;
+    }
+
+    return EXIT_FAILURE;
+}
+
+static int _main_probe(const char* pTsFileName, const char* pCacheName)
+{
+    return ts_demuxer_probe(pTsFileName, pCacheName, PROBE_BUDGET, PROBE_TIME, NULL);
+}
+
+static int _main_playout(const char* pTsFileName, const char* pTarget)
+{
+    // Stream written to stdout must not be mixed with messages
+    if ((! strcmp(pTarget, "-")) && (ts_playout_stdout() != EXIT_SUCCESS))
+    {
+        ERR("Cannot redirect messages to stderr\n");
+        return EXIT_FAILURE;
+    }
+
+    P_TS_DEMUXER pDemuxer = ts_demuxer_create(pTsFileName);
+
+    if (pDemuxer != BAD_TS_DEMUXER)
+    {
+        int nResult = ts_demuxer_playout(pDemuxer, pTarget);
+
+        ts_demuxer_free(pDemuxer);
+        return nResult;
+    }
+
+    return EXIT_FAILURE;
+}
+
+static int _main_segment(const char* pDuration, const char* pTsFileName, const char* pPrefix)
+{
+    int nDuration = atoi(pDuration);
+
+    if (nDuration <= 0)
+    {
+        ERR("Incorrect segment duration \"%s\"\n", pDuration);
+        return EXIT_FAILURE;
+    }
+
+    P_TS_DEMUXER pDemuxer = ts_demuxer_create(pTsFileName);
+
+    if (pDemuxer != BAD_TS_DEMUXER)
+    {
+        int nResult = ts_demuxer_segment(pDemuxer, pPrefix, (unsigned int) nDuration);
+
+        ts_demuxer_free(pDemuxer);
+        return nResult;
+    }
+
+    return EXIT_FAILURE;
+}
+
+static int _main_filter(const char* pTsFileName, const char* pOutFileName, const char* pPIDs, unsigned int uRewritePSI)
+{
+    static unsigned int puPIDs[MAX_PIDS_NUM];
+    unsigned int        uPIDsNum = 0;
+
+    // Comma-separated list of PIDs (decimal or hexadecimal with "0x" prefix)
+    for ( ; (*pPIDs) && (uPIDsNum < MAX_PIDS_NUM) ; )
+    {
+        char* pEnd = NULL;
+
+        puPIDs[uPIDsNum ++] = (unsigned int) strtoul(pPIDs, &pEnd, 0);
+
+        if ((pEnd == pPIDs) || ((*pEnd) && (*pEnd != ',')))
+        {
+            ERR("Incorrect PID list \"%s\"\n", pPIDs);
+            return EXIT_FAILURE;
+        }
+
+        pPIDs = (*pEnd) ? (pEnd + 1) : pEnd;
+    }
+
+    P_TS_DEMUXER pDemuxer = ts_demuxer_create(pTsFileName);
+
+    if (pDemuxer != BAD_TS_DEMUXER)
+    {
+        int nResult = EXIT_SUCCESS;
+
+        if (nResult == EXIT_SUCCESS)
+            nResult = ts_demuxer_add_ts_output(pDemuxer, pOutFileName, puPIDs, uPIDsNum, uRewritePSI);
+
+        if (nResult == EXIT_SUCCESS)
+            nResult = ts_demuxer_start(pDemuxer);
+
+        ts_demuxer_free(pDemuxer);
+        return nResult;
+    }
+
+    return EXIT_FAILURE;
+}
+
+static int _main_shm_read(const char* pName, const char* pOutFileName)
+{
+    P_SHM_RING   pRing       = BAD_SHM_RING;
+    unsigned int uWaited     = 0;
+    unsigned int uRecordsNum = 0;
+    unsigned int uUnitsNum   = 0;
+    int          nResult     = EXIT_SUCCESS;
+
+    unsigned long long lluLostNum = 0;
+
+    // Producer may be started after the reader
+    for ( ; ((pRing = shm_ring_open(pName)) == BAD_SHM_RING) && (uWaited < SHM_OPEN_TIME) ; uWaited += SHM_POLL_TIME)
+        usleep(SHM_POLL_TIME * 1000);
+
+    if (pRing == BAD_SHM_RING)
+    {
+        ERR("Cannot open shared memory ring \"%s\"\n", pName);
+        return EXIT_FAILURE;
+    }
+
+    FILE* pFile = fopen(pOutFileName, "wb");
+
+    if (! pFile)
+    {
+        ERR("Cannot open output file \"%s\"\n", pOutFileName);
+        shm_ring_free(pRing);
+        return EXIT_FAILURE;
+    }
+
+    // Payload is copied from the ring to the output, then the record is checked for being overwritten meanwhile
+    for ( ; (nResult == EXIT_SUCCESS) && (! shm_ring_closed(pRing)) ; )
+    {
+        const SHM_RING_RECORD* pRecord = NULL;
+        unsigned int           uLength = 0;
+        unsigned long long     lluLost = 0;
+
+        // Length is validated by the ring, the one in the record may be overwritten meanwhile
+        if (shm_ring_read(pRing, &pRecord, &uLength, &lluLost) != EXIT_SUCCESS)
+        {
+            lluLostNum += lluLost;
+            usleep(SHM_POLL_TIME * 1000);
+            continue;
+        }
+
+        lluLostNum += lluLost;
+
+        if (fwrite(pRecord + 1, 1, uLength, pFile) != uLength)
+            nResult = EXIT_FAILURE;
+
+        if (shm_ring_check(pRing) != EXIT_SUCCESS)
+        {
+            ERR("Record was overwritten while it was read\n");
+            nResult = EXIT_FAILURE;
+        }
+
+        uRecordsNum += 1;
+        uUnitsNum   += (pRecord->uFlags & SHM_RING_FLAG_UNIT_START) ? 1 : 0;
+    }
+
+    fclose(pFile);
+    shm_ring_free(pRing);
+
+    OUT("%u records (%u units) were read, %llu bytes were lost\n", uRecordsNum, uUnitsNum, lluLostNum);
+    return nResult;
+}
+
+static int _main_server(const char* pTimeout, const char* pListFileName)
+{
+    char         pLine[MAX_LINE_LENGTH];
+    char         pInput[MAX_LINE_LENGTH];
+    char         pVideo[MAX_LINE_LENGTH];
+    char         pAudio[MAX_LINE_LENGTH];
+    char         pFlush[MAX_LINE_LENGTH];
+    unsigned int uChannelsNum = 0;
+    int          nTimeout     = atoi(pTimeout);
+    int          nResult      = EXIT_SUCCESS;
+
+    if ((nTimeout < 0) || (nTimeout > MAX_FOLLOW_TIME))
+    {
+        ERR("Incorrect idle timeout \"%s\"\n", pTimeout);
+        return EXIT_FAILURE;
+    }
+
+    // Channel list: one "<input> <video.out|-> <audio.out|-> [<policy>[,<audio policy>]]" line per channel, '#' starts a comment
+    FILE* pList = fopen(pListFileName, "r");
+
+    if (! pList)
+    {
+        ERR("Cannot open channel list \"%s\"\n", pListFileName);
+        return EXIT_FAILURE;
+    }
+
+    for ( ; (fgets(pLine, sizeof(pLine), pList)) ; )
+    {
+        if (sscanf(pLine, "%s %s %s", pInput, pVideo, pAudio) == 3)
+            uChannelsNum += (pInput[0] != '#');
+    }
+
+    P_TS_SERVER pServer = ts_server_create(uChannelsNum);
+
+    if (pServer == BAD_TS_SERVER)
+    {
+        fclose(pList);
+        return EXIT_FAILURE;
+    }
+
+    rewind(pList);
+
+    for ( ; (nResult == EXIT_SUCCESS) && (fgets(pLine, sizeof(pLine), pList)) ; )
+    {
+        ES_FLUSH_POLICY pFlushes[ES_OUTPUT_MAX_NUM];
+        unsigned int    pValues [ES_OUTPUT_MAX_NUM];
+        int             nFields = sscanf(pLine, "%s %s %s %s", pInput, pVideo, pAudio, pFlush);
+
+        if ((nFields < 3) || (pInput[0] == '#'))
+            continue;
+
+        memcpy(pFlushes, pMainFlush,      sizeof(pFlushes));
+        memcpy(pValues,  pMainFlushValue, sizeof(pValues));
+
+        // Policies of the channel override the "-flush" option
+        if ((nFields == 4) && (_main_parse_flush(pFlush, pFlushes, pValues) != EXIT_SUCCESS))
+        {
+            nResult = EXIT_FAILURE;
+            break;
+        }
+
+        nResult = ts_server_add_channel(pServer,
+                                        pInput,
+                                        strcmp(pVideo, "-") ? pVideo : NULL,
+                                        strcmp(pAudio, "-") ? pAudio : NULL,
+                                        pFlushes,
+                                        pValues);
+    }
+
+    fclose(pList);
+
+    if (nResult == EXIT_SUCCESS)
+        nResult = ts_server_run(pServer, (unsigned int) nTimeout * 1000);
+
+    ts_server_free(pServer);
+    return nResult;
+}
 
 // Main routine
 //
-// Command-line arguments:
+// Command-line arguments (demux mode):
 // 1 (argv[0]) = Application name
 // 2 (argv[1]) = Input TS file location
 // 3 (argv[2]) = Output video file location
 // 4 (argv[3]) = Output audio file location
-int main(const int argc, const char* argv[])
+//
+// Command-line arguments (demux mode with checkpoints):
+// 1 (argv[0]) = Application name
+// 2 (argv[1]) = "-checkpoint" (start from the beginning) or "-resume" (continue from the checkpoint)
+// 3 (argv[2]) = Checkpoint file location
+// 4 (argv[3]) = Input TS file location
+// 5 (argv[4]) = Output video file location
+// 6 (argv[5]) = Output audio file location
+//
+// Command-line arguments (demux mode for file which is still being written):
+// 1 (argv[0]) = Application name
+// 2 (argv[1]) = "-follow"
+// 3 (argv[2]) = Idle timeout in seconds
+// 4 (argv[3]) = Input TS file location
+// 5 (argv[4]) = Output video file location
+// 6 (argv[5]) = Output audio file location
+//
+// Command-line arguments (demux mode with whole PES writing):
+// 1 (argv[0]) = Application name
+// 2 (argv[1]) = "-reassemble"
+// 3 (argv[2]) = Input TS file location
+// 4 (argv[3]) = Output video file location
+// 5 (argv[4]) = Output audio file location
+//
+// Command-line arguments (scan mode):
+// 1 (argv[0]) = Application name
+// 2 (argv[1]) = "-scan"
+// 3 (argv[2]) = Input TS file location
+//
+// Command-line arguments (probe mode):
+// 1 (argv[0]) = Application name
+// 2 (argv[1]) = "-probe"
+// 3 (argv[2]) = Input TS file location
+// 4 (argv[3]) = Probe cache file location (optional)
+//
+// Command-line arguments (playout mode):
+// 1 (argv[0]) = Application name
+// 2 (argv[1]) = "-playout"
+// 3 (argv[2]) = Input TS file location
+// 4 (argv[3]) = Target: "udp://address:port", pipe or file location, "-" for standard output
+//
+// Command-line arguments (segment mode):
+// 1 (argv[0]) = Application name
+// 2 (argv[1]) = "-segment"
+// 3 (argv[2]) = Segment duration in seconds
+// 4 (argv[3]) = Input TS file location
+// 5 (argv[4]) = Output prefix ("<prefix>00000.ts", ..., "<prefix>.m3u8")
+//
+// Command-line arguments (filter mode):
+// 1 (argv[0]) = Application name
+// 2 (argv[1]) = "-filter" or "-filter-psi" (with PAT/PMT rewriting)
+// 3 (argv[2]) = Input TS file location
+// 4 (argv[3]) = Output TS file location
+// 5 (argv[4]) = Comma-separated list of PIDs to keep
+//
+// Command-line arguments (shared memory reader mode):
+// 1 (argv[0]) = Application name
+// 2 (argv[1]) = "-shm-read"
+// 3 (argv[2]) = Shared memory ring name (output "shm://<name>" of the demuxer)
+// 4 (argv[3]) = Output file location
+//
+// Command-line arguments (server mode):
+// 1 (argv[0]) = Application name
+// 2 (argv[1]) = "-server"
+// 3 (argv[2]) = Idle timeout in seconds (0 means no timeout)
+// 4 (argv[3]) = Channel list file location
+//
+// Any demux or server mode can be prefixed with the flush policy of ES outputs:
+// 1 (argv[0]) = Application name
+// 2 (argv[1]) = "-flush"
+// 3 (argv[2]) = "none" (default), "unit" (every PES), "deadline:<ms>" or "bytes:<bytes>",
+//               "<video policy>,<audio policy>" sets the outputs separately
+// 4...        = Arguments of the mode
+static int _main_run(const int argc, const char* argv[])
 {
-    if (argc == 4)
+    if ((argc == 3) && (! strcmp(argv[1], "-scan")))
     {
-        const char* pTsFileName    = argv[1];
-        const char* pVideoFileName = argv[2];
-        const char* pAudioFileName = argv[3];
-
-        P_TS_DEMUXER pDemuxer = ts_demuxer_create(pTsFileName);
+        return _main_scan(argv[2]);
+    }
+    else if (((argc == 3) || (argc == 4)) && (! strcmp(argv[1], "-probe")))
+    {
+        return _main_probe(argv[2], (argc == 4) ? argv[3] : NULL);
+    }
+    else if ((argc == 4) && (! strcmp(argv[1], "-playout")))
+    {
+        return _main_playout(argv[2], argv[3]);
+    }
+    else if ((argc == 5) && (! strcmp(argv[1], "-segment")))
+    {
+        return _main_segment(argv[2], argv[3], argv[4]);
+    }
+    else if ((argc == 5) && (! strcmp(argv[1], "-filter")))
+    {
+        return _main_filter(argv[2], argv[3], argv[4], 0);
+    }
+    else if ((argc == 5) && (! strcmp(argv[1], "-filter-psi")))
+    {
+        return _main_filter(argv[2], argv[3], argv[4], 1);
+    }
+    else if ((argc == 4) && (! strcmp(argv[1], "-shm-read")))
+    {
+        return _main_shm_read(argv[2], argv[3]);
+    }
+    else if ((argc == 4) && (! strcmp(argv[1], "-server")))
+    {
+        return _main_server(argv[2], argv[3]);
+    }
+    else if ((argc == 6) && (! strcmp(argv[1], "-checkpoint")))
+    {
+        return _main_demux(argv[3], argv[4], argv[5], argv[2], 0, 0, 0);
+    }
+    else if ((argc == 6) && (! strcmp(argv[1], "-resume")))
+    {
+        return _main_demux(argv[3], argv[4], argv[5], argv[2], 1, 0, 0);
+    }
+    else if ((argc == 6) && (! strcmp(argv[1], "-follow")))
+    {
+        int nTimeout = atoi(argv[2]);
 
-        if (pDemuxer != BAD_TS_DEMUXER)
+        if ((nTimeout <= 0) || (nTimeout > MAX_FOLLOW_TIME))
         {
-            int nResult = EXIT_SUCCESS;
-
-            if (nResult == EXIT_SUCCESS)
-                nResult = ts_demuxer_add_output(pDemuxer, ES_OUTPUT_VIDEO, pVideoFileName);
-
-            if (nResult == EXIT_SUCCESS)
-                nResult = ts_demuxer_add_output(pDemuxer, ES_OUTPUT_AUDIO, pAudioFileName);
-
-            if (nResult == EXIT_SUCCESS)
-                nResult = ts_demuxer_start(pDemuxer);
-
-            ts_demuxer_free(pDemuxer);
-            return nResult;
+            ERR("Incorrect idle timeout \"%s\"\n", argv[2]);
+            return EXIT_FAILURE;
         }
+
+        return _main_demux(argv[3], argv[4], argv[5], NULL, 0, (unsigned int) nTimeout * 1000, 0);
+    }
+    else if ((argc == 5) && (! strcmp(argv[1], "-reassemble")))
+    {
+        return _main_demux(argv[2], argv[3], argv[4], NULL, 0, 0, PES_POOL_LIMIT);
+    }
+    else if (argc == 4)
+    {
+        return _main_demux(argv[1], argv[2], argv[3], NULL, 0, 0, 0);
     }
     else
     {
         OUT("\n");
         OUT("  Usage:\n");
         OUT("  ts_demuxer <input.ts> <video.out> <audio.out>\n");
+        OUT("  ts_demuxer -checkpoint|-resume <checkpoint> <input.ts> <video.out> <audio.out>\n");
+        OUT("  ts_demuxer -follow <seconds> <input.ts> <video.out> <audio.out>\n");
+        OUT("  ts_demuxer -reassemble <input.ts> <video.out> <audio.out>\n");
+        OUT("  ts_demuxer -scan <input.ts>\n");
+        OUT("  ts_demuxer -probe <input.ts> [<cache>]\n");
+        OUT("  ts_demuxer -playout <input.ts> udp://<address>:<port>|<output>|-\n");
+        OUT("  ts_demuxer -segment <seconds> <input.ts> <prefix>\n");
+        OUT("  ts_demuxer -filter|-filter-psi <input.ts> <output.ts> <PID>[,<PID>...]\n");
+        OUT("  ts_demuxer -server <seconds> <channels.list>\n");
+        OUT("  ts_demuxer -shm-read <name> <output>\n");
+        OUT("  ts_demuxer -flush <policy>[,<audio policy>] <mode arguments>\n");
+        OUT("  Flush policy is none, unit, deadline:<ms> or bytes:<bytes>\n");
+        OUT("  Any video or audio output can be \"shm://<name>\" shared memory ring\n");
         OUT("\n");
     }
 
     return EXIT_FAILURE;
 }
+
+int main(const int argc, const char* argv[])
+{
+    if ((argc > 2) && (! strcmp(argv[1], "-flush")))
+    {
+        if (_main_parse_flush(argv[2], pMainFlush, pMainFlushValue) != EXIT_SUCCESS)
+            return EXIT_FAILURE;
+
+        // The rest is parsed as if the option was not there
+        const char* pArgs[argc - 1];
+        int         i;
+
+        pArgs[0] = argv[0];
+
+        for (i = 3; i < argc; i ++)
+            pArgs[i - 2] = argv[i];
+
+        return _main_run(argc - 2, pArgs);
+    }
+
+    return _main_run(argc, argv);
+}
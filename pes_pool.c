@@ -0,0 +1,130 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "print_out.h"
+#include "pes_pool.h"
+
+// Buffers are grouped into power-of-two size classes from 4 KiB to 16 MiB
+#define PES_POOL_CLASS_MIN  12
+#define PES_POOL_CLASS_MAX  24
+#define PES_POOL_CLASSES    (PES_POOL_CLASS_MAX - PES_POOL_CLASS_MIN + 1)
+
+typedef struct _PES_POOL_BLOCK {
+    struct _PES_POOL_BLOCK* pNext;
+    unsigned int            uClass;
+    unsigned int            uReserved;
+} PES_POOL_BLOCK;
+
+typedef struct _PES_POOL {
+    PES_POOL_BLOCK*    pFree[PES_POOL_CLASSES];
+    unsigned long long lluAllocated;
+    unsigned long long lluLimit;
+    unsigned int       uBlocksNum;
+} PES_POOL;
+
+P_PES_POOL pes_pool_create(unsigned int uLimit)
+{
+    // Memory allocation for description struct, blocks are allocated on demand and never released before the pool
+    PES_POOL* pPesPool = (PES_POOL*) calloc(1, sizeof(PES_POOL));
+
+    if (! pPesPool)
+        return BAD_PES_POOL;
+
+    OUT("PES pool          : %u bytes\n", uLimit);
+
+    pPesPool->lluLimit = uLimit;
+
+    // Return the pointer to description struct
+    return (P_PES_POOL) pPesPool;
+}
+
+void pes_pool_free(P_PES_POOL pPool)
+{
+    PES_POOL* pPesPool = (PES_POOL*) pPool;
+
+    if (pPesPool)
+    {
+        unsigned int i;
+
+        // All buffers must be returned to the pool before it is released
+        for (i = 0; i < PES_POOL_CLASSES; i ++)
+        {
+            PES_POOL_BLOCK* pBlock = pPesPool->pFree[i];
+
+            for ( ; (pBlock) ; )
+            {
+                PES_POOL_BLOCK* pNext = pBlock->pNext;
+                free(pBlock);
+                pBlock = pNext;
+            }
+        }
+
+        DBG("PES pool: %u blocks, %llu bytes\n", pPesPool->uBlocksNum, pPesPool->lluAllocated);
+
+        free(pPesPool);
+    }
+}
+
+unsigned char* pes_pool_get(P_PES_POOL pPool, unsigned int uSize, unsigned int* pCapacity)
+{
+    PES_POOL*       pPesPool = (PES_POOL*) pPool;
+    PES_POOL_BLOCK* pBlock   = NULL;
+    unsigned int    uClass   = PES_POOL_CLASS_MIN;
+
+    if (! pPesPool)
+        return NULL;
+
+    for ( ; ((1U << uClass) < uSize) ; uClass ++)
+    {
+        if (uClass >= PES_POOL_CLASS_MAX)
+        {
+            ERR("PES pool : %u bytes buffer is too large\n", uSize);
+            return NULL;
+        }
+    }
+
+    pBlock = pPesPool->pFree[uClass - PES_POOL_CLASS_MIN];
+
+    if (pBlock)
+    {
+        // Recycled buffer
+        pPesPool->pFree[uClass - PES_POOL_CLASS_MIN] = pBlock->pNext;
+    }
+    else
+    {
+        // New buffer within the pool limit
+        if ((pPesPool->lluAllocated + (1U << uClass)) > pPesPool->lluLimit)
+        {
+            ERR("PES pool : limit of %llu bytes is reached\n", pPesPool->lluLimit);
+            return NULL;
+        }
+
+        pBlock = (PES_POOL_BLOCK*) malloc(sizeof(PES_POOL_BLOCK) + (1U << uClass));
+
+        if (! pBlock)
+            return NULL;
+
+        pBlock->uClass = uClass;
+
+        pPesPool->lluAllocated += (1U << uClass);
+        pPesPool->uBlocksNum   += 1;
+    }
+
+    pBlock->pNext = NULL;
+
+    if (pCapacity) *pCapacity = 1U << uClass;
+
+    return (unsigned char*) (pBlock + 1);
+}
+
+void pes_pool_put(P_PES_POOL pPool, unsigned char* pBuffer)
+{
+    PES_POOL*       pPesPool = (PES_POOL*) pPool;
+    PES_POOL_BLOCK* pBlock   = ((PES_POOL_BLOCK*) pBuffer) - 1;
+
+    if ((! pPesPool) || (! pBuffer))
+        return;
+
+    pBlock->pNext = pPesPool->pFree[pBlock->uClass - PES_POOL_CLASS_MIN];
+    pPesPool->pFree[pBlock->uClass - PES_POOL_CLASS_MIN] = pBlock;
+}
@@ -0,0 +1,14 @@
+#ifndef __PES_POOL_H__
+#define __PES_POOL_H__
+
+typedef void* P_PES_POOL;
+
+#define BAD_PES_POOL ((P_PES_POOL) NULL)
+
+P_PES_POOL     pes_pool_create (unsigned int uLimit);
+void           pes_pool_free   (P_PES_POOL pPool);
+
+unsigned char* pes_pool_get    (P_PES_POOL pPool, unsigned int uSize, unsigned int* pCapacity);
+void           pes_pool_put    (P_PES_POOL pPool, unsigned char* pBuffer);
+
+#endif // __PES_POOL_H__
@@ -0,0 +1,367 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "print_out.h"
+#include "shm_ring.h"
+
+#define SHM_RING_NAME_MAX  256
+#define SHM_RING_SIZE_MIN  (64 * 1024)
+
+typedef struct _SHM_RING {
+    char               pName[SHM_RING_NAME_MAX];
+    SHM_RING_HEADER*   pHeader;
+    unsigned char*     pData;
+    size_t             nMapSize;
+    unsigned int       uDataSize;
+    unsigned int       uProducer;
+    unsigned int       uSequence;
+    unsigned long long lluCursor;
+    unsigned long long lluRecord;
+} SHM_RING;
+
+static int _shm_ring_name(SHM_RING* pShmRing, const char* pName)
+{
+    // POSIX shared memory object name has a single leading slash
+    const char* pSlash = (pName[0] == '/') ? "" : "/";
+
+    if ((! pName[0]) || (snprintf(pShmRing->pName, sizeof(pShmRing->pName), "%s%s", pSlash, pName) >= (int) sizeof(pShmRing->pName)))
+    {
+        ERR("Incorrect shared memory name \"%s\"\n", pName);
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+static void _shm_ring_put(SHM_RING*            pShmRing,
+                          unsigned int         uPID,
+                          unsigned int         uFlags,
+                          unsigned long long   lluPTS,
+                          unsigned long long   lluDTS,
+                          const unsigned char* pData,
+                          unsigned int         uLength)
+{
+    SHM_RING_HEADER*   pHeader  = pShmRing->pHeader;
+    unsigned long long lluPos   = pHeader->lluWritten;
+    unsigned int       uOffset  = (unsigned int) (lluPos & (pShmRing->uDataSize - 1));
+    unsigned int       uSize    = (sizeof(SHM_RING_RECORD) + uLength + SHM_RING_ALIGN - 1) & ~(SHM_RING_ALIGN - 1);
+    SHM_RING_RECORD*   pRecord  = NULL;
+
+    // Record never wraps, the rest of the data area is filled by padding record
+    if ((uOffset + uSize) > pShmRing->uDataSize)
+    {
+        unsigned int uRest = pShmRing->uDataSize - uOffset;
+
+        __atomic_store_n(&pHeader->lluReserved, lluPos + uRest, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+
+        pRecord = (SHM_RING_RECORD*) (pShmRing->pData + uOffset);
+        memset(pRecord, 0, sizeof(SHM_RING_RECORD));
+        pRecord->uSize  = uRest;
+        pRecord->uFlags = SHM_RING_FLAG_PADDING;
+
+        lluPos += uRest;
+        uOffset = 0;
+
+        __atomic_store_n(&pHeader->lluWritten, lluPos, __ATOMIC_RELEASE);
+    }
+
+    // Readers see the reservation before the old records are overwritten
+    __atomic_store_n(&pHeader->lluReserved, lluPos + uSize, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    pRecord = (SHM_RING_RECORD*) (pShmRing->pData + uOffset);
+    pRecord->uSize     = uSize;
+    pRecord->uPID      = (unsigned short) uPID;
+    pRecord->uFlags    = (unsigned short) uFlags;
+    pRecord->lluPTS    = lluPTS;
+    pRecord->lluDTS    = lluDTS;
+    pRecord->uLength   = uLength;
+    pRecord->uSequence = pShmRing->uSequence ++;
+
+    memcpy(pRecord + 1, pData, uLength);
+
+    // Record is complete
+    pHeader->lluRecordsNum += 1;
+    __atomic_store_n(&pHeader->lluWritten, lluPos + uSize, __ATOMIC_RELEASE);
+}
+
+P_SHM_RING shm_ring_create(const char* pName, unsigned int uDataSize)
+{
+    if ((! pName) || (uDataSize < SHM_RING_SIZE_MIN) || (uDataSize & (uDataSize - 1)))
+        return BAD_SHM_RING;
+
+    // Memory allocation for ring description struct
+    SHM_RING* pShmRing = (SHM_RING*) calloc(1, sizeof(SHM_RING));
+
+    if (! pShmRing)
+        return BAD_SHM_RING;
+
+    if (_shm_ring_name(pShmRing, pName) != EXIT_SUCCESS)
+    {
+        free(pShmRing);
+        return BAD_SHM_RING;
+    }
+
+    // Shared memory object is created from scratch, readers of the previous one keep their mapping
+    shm_unlink(pShmRing->pName);
+
+    int nFd = shm_open(pShmRing->pName, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+
+    pShmRing->nMapSize  = sizeof(SHM_RING_HEADER) + uDataSize;
+    pShmRing->uDataSize = uDataSize;
+    pShmRing->uProducer = 1;
+
+    if ((nFd < 0) || (ftruncate(nFd, (off_t) pShmRing->nMapSize) < 0))
+    {
+        ERR("Cannot create shared memory \"%s\"\n", pShmRing->pName);
+
+        if (nFd >= 0)
+        {
+            close(nFd);
+            shm_unlink(pShmRing->pName);
+        }
+
+        free(pShmRing);
+        return BAD_SHM_RING;
+    }
+
+    void* pMap = mmap(NULL, pShmRing->nMapSize, PROT_READ | PROT_WRITE, MAP_SHARED, nFd, 0);
+
+    close(nFd);
+
+    if (pMap == MAP_FAILED)
+    {
+        ERR("Cannot map shared memory \"%s\"\n", pShmRing->pName);
+        shm_unlink(pShmRing->pName);
+        free(pShmRing);
+        return BAD_SHM_RING;
+    }
+
+    pShmRing->pHeader = (SHM_RING_HEADER*) pMap;
+    pShmRing->pData   = (unsigned char*) pMap + sizeof(SHM_RING_HEADER);
+
+    // New object is zero-filled, magic value makes it valid for readers
+    pShmRing->pHeader->uVersion    = SHM_RING_VERSION;
+    pShmRing->pHeader->uHeaderSize = sizeof(SHM_RING_HEADER);
+    pShmRing->pHeader->uDataSize   = uDataSize;
+    pShmRing->pHeader->uState      = SHM_RING_STATE_OPEN;
+
+    __atomic_store_n(&pShmRing->pHeader->uMagic, SHM_RING_MAGIC, __ATOMIC_RELEASE);
+
+    OUT("Shared memory ring: \"%s\", %u bytes\n", pShmRing->pName, uDataSize);
+
+    // Return the pointer to ring description struct
+    return (P_SHM_RING) pShmRing;
+}
+
+int shm_ring_write(P_SHM_RING pRing, unsigned int uPID, unsigned int uFlags, unsigned long long lluPTS, unsigned long long lluDTS, const unsigned char* pData, unsigned int uLength)
+{
+    SHM_RING*    pShmRing = (SHM_RING*) pRing;
+    unsigned int uMax;
+
+    if ((! pShmRing) || (! pShmRing->uProducer))
+        return EXIT_FAILURE;
+
+    // Large payload is split, so that any reader which keeps up gets whole records
+    uMax = pShmRing->uDataSize / 4 - sizeof(SHM_RING_RECORD);
+
+    for ( ; ; )
+    {
+        unsigned int uPart  = (uLength > uMax) ? uMax : uLength;
+        unsigned int uLast  = (uPart == uLength);
+        unsigned int uClear = uLast ? 0 : SHM_RING_FLAG_UNIT_END;
+
+        _shm_ring_put(pShmRing, uPID, uFlags & ~uClear, lluPTS, lluDTS, pData, uPart);
+
+        if (uLast)
+            break;
+
+        // Unit start and timestamps belong to the first fragment only
+        uFlags &= ~(SHM_RING_FLAG_UNIT_START | SHM_RING_FLAG_PTS | SHM_RING_FLAG_DTS | SHM_RING_FLAG_LOSS);
+
+        pData   += uPart;
+        uLength -= uPart;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+P_SHM_RING shm_ring_open(const char* pName)
+{
+    struct stat tStat;
+
+    if (! pName)
+        return BAD_SHM_RING;
+
+    // Memory allocation for ring description struct
+    SHM_RING* pShmRing = (SHM_RING*) calloc(1, sizeof(SHM_RING));
+
+    if (! pShmRing)
+        return BAD_SHM_RING;
+
+    if (_shm_ring_name(pShmRing, pName) != EXIT_SUCCESS)
+    {
+        free(pShmRing);
+        return BAD_SHM_RING;
+    }
+
+    int nFd = shm_open(pShmRing->pName, O_RDONLY | O_CLOEXEC, 0);
+
+    if ((nFd < 0) || (fstat(nFd, &tStat) < 0) || ((size_t) tStat.st_size <= sizeof(SHM_RING_HEADER)))
+    {
+        if (nFd >= 0)
+            close(nFd);
+
+        free(pShmRing);
+        return BAD_SHM_RING;
+    }
+
+    pShmRing->nMapSize = (size_t) tStat.st_size;
+
+    void* pMap = mmap(NULL, pShmRing->nMapSize, PROT_READ, MAP_SHARED, nFd, 0);
+
+    close(nFd);
+
+    if (pMap == MAP_FAILED)
+    {
+        free(pShmRing);
+        return BAD_SHM_RING;
+    }
+
+    pShmRing->pHeader   = (SHM_RING_HEADER*) pMap;
+    pShmRing->pData     = (unsigned char*) pMap + sizeof(SHM_RING_HEADER);
+    pShmRing->uDataSize = pShmRing->pHeader->uDataSize;
+
+    // Ring is not initialized yet or has another layout
+    if ((__atomic_load_n(&pShmRing->pHeader->uMagic, __ATOMIC_ACQUIRE) != SHM_RING_MAGIC)
+    ||  (pShmRing->pHeader->uVersion    != SHM_RING_VERSION)
+    ||  (pShmRing->pHeader->uHeaderSize != sizeof(SHM_RING_HEADER))
+    ||  ((sizeof(SHM_RING_HEADER) + pShmRing->uDataSize) != pShmRing->nMapSize))
+    {
+        munmap(pMap, pShmRing->nMapSize);
+        free(pShmRing);
+        return BAD_SHM_RING;
+    }
+
+    // Reader starts from the oldest record if nothing was overwritten yet
+    if (__atomic_load_n(&pShmRing->pHeader->lluReserved, __ATOMIC_ACQUIRE) > pShmRing->uDataSize)
+        pShmRing->lluCursor = __atomic_load_n(&pShmRing->pHeader->lluWritten, __ATOMIC_ACQUIRE);
+
+    pShmRing->lluRecord = pShmRing->lluCursor;
+
+    // Return the pointer to ring description struct
+    return (P_SHM_RING) pShmRing;
+}
+
+int shm_ring_read(P_SHM_RING pRing, const SHM_RING_RECORD** ppRecord, unsigned int* pLength, unsigned long long* pLost)
+{
+    SHM_RING*          pShmRing = (SHM_RING*) pRing;
+    SHM_RING_HEADER*   pHeader  = NULL;
+    unsigned long long lluLost  = 0;
+
+    if ((! pShmRing) || (pShmRing->uProducer) || (! ppRecord))
+        return EXIT_FAILURE;
+
+    pHeader = pShmRing->pHeader;
+
+    for ( ; ; )
+    {
+        unsigned long long lluWritten = __atomic_load_n(&pHeader->lluWritten, __ATOMIC_ACQUIRE);
+
+        if (pShmRing->lluCursor >= lluWritten)
+            break;
+
+        unsigned int     uOffset = (unsigned int) (pShmRing->lluCursor & (pShmRing->uDataSize - 1));
+        SHM_RING_RECORD* pRecord = (SHM_RING_RECORD*) (pShmRing->pData + uOffset);
+        unsigned int     uSize   = pRecord->uSize;
+        unsigned int     uFlags  = pRecord->uFlags;
+        unsigned int     uLength = pRecord->uLength;
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+        // Reader was overrun: the rest of overwritten data is skipped.
+        // Fields read before the fence are intact, the ones in the record may change afterwards.
+        if (((__atomic_load_n(&pHeader->lluReserved, __ATOMIC_RELAXED) - pShmRing->lluCursor) > pShmRing->uDataSize)
+        ||  (uSize < sizeof(SHM_RING_RECORD))
+        ||  (uSize > (pShmRing->uDataSize - uOffset))
+        ||  (uLength > (uSize - sizeof(SHM_RING_RECORD))))
+        {
+            lluWritten = __atomic_load_n(&pHeader->lluWritten, __ATOMIC_ACQUIRE);
+            lluLost   += lluWritten - pShmRing->lluCursor;
+
+            pShmRing->lluCursor = lluWritten;
+            continue;
+        }
+
+        pShmRing->lluRecord  = pShmRing->lluCursor;
+        pShmRing->lluCursor += uSize;
+
+        if (uFlags & SHM_RING_FLAG_PADDING)
+            continue;
+
+        *ppRecord = pRecord;
+
+        if (pLength) *pLength = uLength;
+        if (pLost)   *pLost   = lluLost;
+
+        return EXIT_SUCCESS;
+    }
+
+    if (pLost) *pLost = lluLost;
+
+    return EXIT_FAILURE;
+}
+
+int shm_ring_check(P_SHM_RING pRing)
+{
+    SHM_RING* pShmRing = (SHM_RING*) pRing;
+
+    if ((! pShmRing) || (pShmRing->uProducer))
+        return EXIT_FAILURE;
+
+    // Last record returned by shm_ring_read() was not overwritten while it was used
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+    if ((__atomic_load_n(&pShmRing->pHeader->lluReserved, __ATOMIC_RELAXED) - pShmRing->lluRecord) > pShmRing->uDataSize)
+        return EXIT_FAILURE;
+
+    return EXIT_SUCCESS;
+}
+
+int shm_ring_closed(P_SHM_RING pRing)
+{
+    SHM_RING* pShmRing = (SHM_RING*) pRing;
+
+    if (! pShmRing)
+        return 1;
+
+    // Producer is finished and everything it wrote was read
+    return (__atomic_load_n(&pShmRing->pHeader->uState, __ATOMIC_ACQUIRE) == SHM_RING_STATE_CLOSED)
+        && (pShmRing->lluCursor >= __atomic_load_n(&pShmRing->pHeader->lluWritten, __ATOMIC_ACQUIRE));
+}
+
+void shm_ring_free(P_SHM_RING pRing)
+{
+    SHM_RING* pShmRing = (SHM_RING*) pRing;
+
+    if (pShmRing)
+    {
+        // Readers which are still attached can drain the ring, new ones cannot open it
+        if (pShmRing->uProducer)
+        {
+            __atomic_store_n(&pShmRing->pHeader->uState, SHM_RING_STATE_CLOSED, __ATOMIC_RELEASE);
+            shm_unlink(pShmRing->pName);
+
+            DBG("Shared memory ring \"%s\": %llu records, %llu bytes\n", pShmRing->pName, pShmRing->pHeader->lluRecordsNum, pShmRing->pHeader->lluWritten);
+        }
+
+        munmap(pShmRing->pHeader, pShmRing->nMapSize);
+        free(pShmRing);
+    }
+}
@@ -0,0 +1,88 @@
+#ifndef __SHM_RING_H__
+#define __SHM_RING_H__
+
+// POSIX shared-memory ring with one producer and any number of readers.
+//
+// Shared object "/<name>" (see /dev/shm) is the header followed by the data area.
+// All fields are in host byte order, positions are byte counters which never wrap:
+// offset in the data area is (position % uDataSize).
+//
+// Producer appends records and never waits for readers. Each reader keeps its own
+// cursor in its own process, so readers do not affect each other or the producer.
+// Reader which falls behind by more than uDataSize bytes loses the overwritten records
+// and continues from the current write position.
+//
+// Writing of a record:
+// 1. lluReserved = record end (it is published before any byte of the data area is touched)
+// 2. record header and payload are copied to the data area
+// 3. lluWritten  = record end (release store)
+//
+// New reader starts from the beginning if nothing was overwritten yet, otherwise from lluWritten.
+//
+// Reading of a record at cursor C (seqlock style, the record is used in place):
+// 1. record is available if C < lluWritten (acquire load)
+// 2. record header and payload are used directly in the data area,
+//    payload length is taken from the header before the fence and checked against uSize
+// 3. record is intact if (lluReserved - C) <= uDataSize (acquire fence before the load)
+
+#define SHM_RING_MAGIC          0x47525354 // "TSRG"
+#define SHM_RING_VERSION        1
+#define SHM_RING_ALIGN          32
+
+#define SHM_RING_STATE_OPEN     0
+#define SHM_RING_STATE_CLOSED   1          // Producer is finished, no records will follow
+
+#define SHM_RING_FLAG_UNIT_START 0x0001    // First fragment of PES payload
+#define SHM_RING_FLAG_UNIT_END   0x0002    // Last fragment of PES payload (whole PES outputs only)
+#define SHM_RING_FLAG_PTS        0x0004    // lluPTS is valid
+#define SHM_RING_FLAG_DTS        0x0008    // lluDTS is valid
+#define SHM_RING_FLAG_LOSS       0x0010    // Data was lost in the input before this fragment
+#define SHM_RING_FLAG_PADDING    0x8000    // Filler up to the end of the data area, no payload
+
+typedef struct _SHM_RING_HEADER {          // 64 bytes at offset 0
+    unsigned int       uMagic;             // SHM_RING_MAGIC, written last on creation
+    unsigned int       uVersion;           // SHM_RING_VERSION
+    unsigned int       uHeaderSize;        // Offset of the data area
+    unsigned int       uDataSize;          // Size of the data area, power of two
+    unsigned long long lluReserved;        // End of the record being written
+    unsigned long long lluWritten;         // End of the last complete record
+    unsigned long long lluRecordsNum;      // Records written, padding excluded
+    unsigned int       uState;             // SHM_RING_STATE_*
+    unsigned int       pReserved[5];
+} SHM_RING_HEADER;
+
+typedef struct _SHM_RING_RECORD {          // 32 bytes at SHM_RING_ALIGN-aligned position, payload follows
+    unsigned int       uSize;              // Header, payload and padding up to SHM_RING_ALIGN
+    unsigned short     uPID;
+    unsigned short     uFlags;             // SHM_RING_FLAG_*
+    unsigned long long lluPTS;             // 90 kHz
+    unsigned long long lluDTS;             // 90 kHz
+    unsigned int       uLength;            // Payload length
+    unsigned int       uSequence;          // Record number (lower 32 bits)
+} SHM_RING_RECORD;
+
+typedef void* P_SHM_RING;
+
+#define BAD_SHM_RING ((P_SHM_RING) NULL)
+
+// Producer
+P_SHM_RING shm_ring_create (const char* pName, unsigned int uDataSize);
+int        shm_ring_write  (P_SHM_RING           pRing,
+                            unsigned int         uPID,
+                            unsigned int         uFlags,
+                            unsigned long long   lluPTS,
+                            unsigned long long   lluDTS,
+                            const unsigned char* pData,
+                            unsigned int         uLength);
+
+// Reader
+P_SHM_RING shm_ring_open   (const char* pName);
+int        shm_ring_read   (P_SHM_RING              pRing,
+                            const SHM_RING_RECORD** ppRecord,
+                            unsigned int*           pLength,
+                            unsigned long long*     pLost);
+int        shm_ring_check  (P_SHM_RING pRing);
+int        shm_ring_closed (P_SHM_RING pRing);
+void       shm_ring_free   (P_SHM_RING pRing);
+
+#endif // __SHM_RING_H__
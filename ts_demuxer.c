@@ -1,8 +1,17 @@
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
 
 #include "print_out.h"
 #include "ts_demuxer.h"
+#include "ts_playout.h"
 
 #define TS_PACKET_SIZE_188  188
 #define TS_PACKET_SIZE_192  192
@@ -20,6 +29,38 @@
 #define TS_PID_PAT          0x0000
 #define TS_PID_MIN          0x0020
 #define TS_PID_MAX          0x1FFA
+#define TS_PID_NULL         0x1FFF
+#define TS_PID_NUM          0x2000
+
+#define PSI_VERSION_NONE    0xFF
+
+#define TS_PID_FLAG_PMT     0x01
+#define TS_PID_FLAG_PCR     0x02
+#define TS_PID_FLAG_ES      0x04
+#define TS_PID_FLAG_PARSED  0x08
+#define TS_PID_FLAG_PAYLOAD 0x10
+#define TS_PID_FLAG_HAS_PCR 0x20
+#define TS_PID_FLAG_HAS_PTS 0x40
+
+#define TS_BULK_BUF_PACKETS 4096
+#define TS_SCAN_PREFETCH    8
+
+#define TS_AF_DISCONTINUITY 0x80
+#define TS_AF_RANDOM_ACCESS 0x40
+#define TS_AF_PCR           0x10
+
+#define SEGMENT_NAME_MAX    4096
+
+#define CHECKPOINT_VERSION  1
+#define CHECKPOINT_NAME_MAX 4096
+
+#define PROBE_CHUNK_PACKETS 64
+#define PROBE_TAIL_PACKETS  1024
+#define PROBE_LINE_MAX      (PATH_MAX + 1024)
+
+#define PLAYOUT_PCR_GAP_MAX 90000           // Larger PCR step is a discontinuity (1 second)
+
+#define PCR_WRAP_90KHZ      (1LLU << 33)
 
 #define TABLE_ID_PAT        0x00
 #define TABLE_ID_PMT        0x02
@@ -27,18 +68,72 @@
 #define ES_STREAM_H264      0x1B
 #define ES_STREAM_ADTS_AAC  0x0F
 
+typedef enum _TS_DEMUXER_MODE {
+    TS_MODE_DEMUX = 0,
+    TS_MODE_SCAN,
+    TS_MODE_SEGMENT,
+    TS_MODE_LIVE,
+    TS_MODE_PROBE,
+    TS_MODE_PLAYOUT
+} TS_DEMUXER_MODE;
+
+typedef struct _TS_PID_INFO {
+    unsigned int       uFlags;
+    unsigned int       uStreamType;
+    unsigned int       uPacketsNum;
+    unsigned int       uErrorsNum;
+    unsigned int       uContinuity;
+    unsigned long long lluFirstPCR;
+    unsigned long long lluLastPCR;
+    unsigned long long lluFirstPTS;
+} TS_PID_INFO;
+
+typedef struct _TS_SEGMENTER {
+    const char*         pPrefix;
+    FILE*               pFile;
+    unsigned int        uIndex;
+    unsigned long long  lluTarget;
+    unsigned int        uStarted;
+    unsigned long long  lluStartPTS;
+    unsigned long long  lluLastPTS;
+    unsigned char*      pPatPacket;
+    unsigned char*      pPmtPacket;
+    unsigned long long* pDurations;
+    unsigned int        uDurationsMax;
+} TS_SEGMENTER;
+
 typedef struct _TS_DEMUXER {
-    const char*  pFileName;
-    FILE*        pFile;
-    unsigned int uFileOffset;
+    const char*        pFileName;
+    FILE*              pFile;
+    unsigned long long lluFileOffset;
+
     unsigned int uPacketSize;
     unsigned int uPacketsNum;
     unsigned int uPMT_PID;
+    unsigned int uPMT_Version;
     unsigned int uPCR_PID;
     unsigned int uVideoPID;
     unsigned int uAudioPID;
     P_ES_OUTPUT  pVideoOutput;
     P_ES_OUTPUT  pAudioOutput;
+    P_TS_OUTPUT  pTsOutput;
+
+    TS_DEMUXER_MODE eMode;
+    TS_PID_INFO*    pPidInfo;
+    unsigned int    uQuiet;   // Tables are parsed without printing (modes with own report)
+
+    const char*        pCheckpointName;
+    unsigned long long lluCheckpointStep;
+    unsigned long long lluCheckpointLast;
+    unsigned long long lluBufferEnd;
+
+    unsigned int uFollowTimeout;
+    unsigned int uErrorsNum;
+
+    P_PES_POOL   pPesPool;
+
+    ES_FLUSH_POLICY pFlush     [ES_OUTPUT_MAX_NUM];
+    unsigned int    pFlushValue[ES_OUTPUT_MAX_NUM];
 } TS_DEMUXER;
 
 static int _ts_demuxer_get_file_info(FILE* pFile, unsigned int* pFileOffset, unsigned int* pPacketSize)
@@ -107,16 +202,58 @@ static int _ts_demuxer_get_file_info(FILE* pFile, unsigned int* pFileOffset, uns
     return EXIT_SUCCESS;
 }
 
+static unsigned long long _ts_demuxer_get_pcr(unsigned char* pAdaptField)
+{
+    // 48-bit program clock reference (PCR):
+    // 33 bits: base
+    //  6 bits: reserved
+    //  9 bits: extension
+    //
+    // PCR (90 kHz clock) = base
+    // PCR (27 MHz clock) = base * 300 + extension
+    //
+    // 90 kHz PCR
+    unsigned long long lluPCR_90kHz  =  pAdaptField[1]; lluPCR_90kHz <<= 8;
+                       lluPCR_90kHz |=  pAdaptField[2]; lluPCR_90kHz <<= 8;
+                       lluPCR_90kHz |=  pAdaptField[3]; lluPCR_90kHz <<= 8;
+                       lluPCR_90kHz |=  pAdaptField[4]; lluPCR_90kHz <<= 1;
+                       lluPCR_90kHz |= (pAdaptField[5] >> 7);
+
+    return lluPCR_90kHz;
+}
+
+static int _ts_demuxer_get_pes_pts(unsigned char* pPayload, unsigned int uPayloadLen, unsigned long long* pPTS)
+{
+    // PES header with PTS: start code, stream ID, length, 2 bytes of flags, header length and 5 bytes of PTS
+    if ((uPayloadLen < 14)
+    ||  (pPayload[0] != 0x00)
+    ||  (pPayload[1] != 0x00)
+    ||  (pPayload[2] != 0x01)
+    || ((pPayload[7] & 0x80) == 0))
+        return EXIT_FAILURE;
+
+    // 33-bit PTS
+    unsigned long long lluPTS_90kHz  = (pPayload[ 9] >> 1) & 0x07; lluPTS_90kHz <<= 8;
+                       lluPTS_90kHz |=  pPayload[10];              lluPTS_90kHz <<= 7;
+                       lluPTS_90kHz |= (pPayload[11] >> 1);        lluPTS_90kHz <<= 8;
+                       lluPTS_90kHz |=  pPayload[12];              lluPTS_90kHz <<= 7;
+                       lluPTS_90kHz |= (pPayload[13] >> 1);
+
+    if (pPTS) *pPTS = lluPTS_90kHz;
+
+    return EXIT_SUCCESS;
+}
+
 static int _ts_demuxer_parse_adapt_field(TS_DEMUXER* pTsDemuxer, unsigned char* pAdaptField, unsigned int uAdaptLen, unsigned int uPID)
 {
-    DBG("%08X : Adaptation field (%u bytes)\n", pTsDemuxer->uFileOffset, uAdaptLen);
+    DBG("%08llX : Adaptation field (%u bytes)\n", pTsDemuxer->lluFileOffset, uAdaptLen);
 
     if (uAdaptLen < 1)
         return EXIT_SUCCESS;
 
     if ((uAdaptLen > 0) && ((uAdaptLen + 5) > pTsDemuxer->uPacketSize))
     {
-        ERR("%08X : Incorrect adaptation field length (%u bytes)\n", pTsDemuxer->uFileOffset, uAdaptLen);
+        ERR("%08llX : Incorrect adaptation field length (%u bytes)\n", pTsDemuxer->lluFileOffset, uAdaptLen);
         return EXIT_FAILURE;
     }
 
@@ -133,22 +270,12 @@ static int _ts_demuxer_parse_adapt_field(TS_DEMUXER* pTsDemuxer, unsigned char*
 
         if ((uPCR) && (uAdaptLen > 6))
         {
-            // 48-bit program clock reference (PCR):
-            // 33 bits: base
-            //  6 bits: reserved
-            //  9 bits: extension
-            //
-            // PCR (90 kHz clock) = base
-            // PCR (27 MHz clock) = base * 300 + extension
-            //
-            // 90 kHz PCR
-            unsigned long long lluPCR_90kHz  =  pAdaptField[1]; lluPCR_90kHz <<= 8;
-                               lluPCR_90kHz |=  pAdaptField[2]; lluPCR_90kHz <<= 8;
-                               lluPCR_90kHz |=  pAdaptField[3]; lluPCR_90kHz <<= 8;
-                               lluPCR_90kHz |=  pAdaptField[4]; lluPCR_90kHz <<= 1;
-                               lluPCR_90kHz |= (pAdaptField[5] >> 7);
+            unsigned long long lluPCR_90kHz = _ts_demuxer_get_pcr(pAdaptField);
 
-            OUT("PID %u: PCR %llu\n", uPID, lluPCR_90kHz);
+            if (pTsDemuxer->eMode == TS_MODE_LIVE)
+                DBG("PID %u: PCR %llu\n", uPID, lluPCR_90kHz);
+            else
+                OUT("PID %u: PCR %llu\n", uPID, lluPCR_90kHz);
         }
     }
 
@@ -171,12 +298,12 @@ static int _ts_demuxer_parse_pat(TS_DEMUXER* pTsDemuxer, unsigned char* pPayload
     ||  (uSectionLength < 4)
     || ((uSectionLength + 4) > uPayloadLen))
     {
-        ERR("%08X : Incorrect table header for PAT (%02X %02X %02X %02X)\n", pTsDemuxer->uFileOffset, pPayload[0], pPayload[1], pPayload[2], pPayload[3]);
+        ERR("%08llX : Incorrect table header for PAT (%02X %02X %02X %02X)\n", pTsDemuxer->lluFileOffset, pPayload[0], pPayload[1], pPayload[2], pPayload[3]);
         return EXIT_FAILURE;
     }
 
     // Special requirements: TS file must include both types of data - video and audio
-    if ((pTsDemuxer->uPMT_PID) && ((! pTsDemuxer->uVideoPID) || (! pTsDemuxer->uAudioPID)))
+    if ((pTsDemuxer->eMode == TS_MODE_DEMUX) && (pTsDemuxer->uPMT_PID) && ((! pTsDemuxer->uVideoPID) || (! pTsDemuxer->uAudioPID)))
     {
         ERR("Second PAT is found but video or audio are not\n");
         return EXIT_FAILURE;
@@ -194,31 +321,35 @@ static int _ts_demuxer_parse_pat(TS_DEMUXER* pTsDemuxer, unsigned char* pPayload
 //      unsigned char uReserved2   = (pSection[2] & 0xC0) >> 6; // Must be equal to 0x03
 //      unsigned char uVersion     = (pSection[2] & 0x3E) >> 1;
 //      unsigned char uCurrent     = (pSection[2] & 0x01);
-        unsigned char uSectionNum  =  pSection[3];
-        unsigned char uSectionLast =  pSection[4];
+//      unsigned char uSectionNum  =  pSection[3];
+//      unsigned char uSectionLast =  pSection[4];
 
         pSection       += 5;
         uSectionLength -= 5;
 
         for ( ; (uSectionLength > 3) ; )
         {
-//          unsigned int  uProgramNum  =  pSection[0]         << 8; // Must be equal to Stream ID
-//                        uProgramNum |=  pSection[1];
+            unsigned int  uProgramNum  =  pSection[0]         << 8;
+                          uProgramNum |=  pSection[1];
 //          unsigned char uReserved3   = (pSection[2] & 0xE0) >> 5; // Must be equal to 0x07
             unsigned int  uPMT_PID     = (pSection[2] & 0x1F) << 8;
                           uPMT_PID    |=  pSection[3];
 
-            if (! pTsDemuxer->uPMT_PID)
-                pTsDemuxer->uPMT_PID = uPMT_PID;
+            // Program number 0 refers to network information table (NIT)
+            if (uProgramNum > 0)
+            {
+                if (! pTsDemuxer->uPMT_PID)
+                    pTsDemuxer->uPMT_PID = uPMT_PID;
 
-            OUT("PID %u: PAT table, PMT PID %u\n", uPID, uPMT_PID);
+                if (pTsDemuxer->pPidInfo)
+                    pTsDemuxer->pPidInfo[uPMT_PID].uFlags |= TS_PID_FLAG_PMT;
 
-            if (uSectionNum >= uSectionLast)
-                break;
+                if (! pTsDemuxer->uQuiet)
+                    OUT("PID %u: PAT table, program %u, PMT PID %u\n", uPID, uProgramNum, uPMT_PID);
+            }
 
             pSection       += 4;
             uSectionLength -= 4;
-            uSectionNum    += 1;
         }
     }
 
@@ -241,7 +372,7 @@ static int _ts_demuxer_parse_pmt(TS_DEMUXER* pTsDemuxer, unsigned char* pPayload
     ||  (uSectionLength < 4)
     || ((uSectionLength + 4) > uPayloadLen))
     {
-        ERR("%08X : Incorrect table header for PMT (%02X %02X %02X %02X)\n", pTsDemuxer->uFileOffset, pPayload[0], pPayload[1], pPayload[2], pPayload[3]);
+        ERR("%08llX : Incorrect table header for PMT (%02X %02X %02X %02X)\n", pTsDemuxer->lluFileOffset, pPayload[0], pPayload[1], pPayload[2], pPayload[3]);
         return EXIT_FAILURE;
     }
 
@@ -275,7 +406,11 @@ static int _ts_demuxer_parse_pmt(TS_DEMUXER* pTsDemuxer, unsigned char* pPayload
             if (! pTsDemuxer->uPCR_PID)
                 pTsDemuxer->uPCR_PID = uPCR_PID;
 
-            OUT("PID %u: PMT table, PCR PID %u\n", uPID, uPCR_PID);
+            if (pTsDemuxer->pPidInfo)
+                pTsDemuxer->pPidInfo[uPCR_PID].uFlags |= TS_PID_FLAG_PCR;
+
+            if (! pTsDemuxer->uQuiet)
+                OUT("PID %u: PMT table, PCR PID %u\n", uPID, uPCR_PID);
 
             if (uSectionLength < (4 + uInfoLen))
                 break;
@@ -293,20 +428,26 @@ static int _ts_demuxer_parse_pmt(TS_DEMUXER* pTsDemuxer, unsigned char* pPayload
                 unsigned int  uStrInfLen  = (pSection[3] & 0x03) << 8;
                               uStrInfLen |=  pSection[4];
 
+                if (pTsDemuxer->pPidInfo)
+                {
+                    pTsDemuxer->pPidInfo[uStreamPID].uFlags     |= TS_PID_FLAG_ES;
+                    pTsDemuxer->pPidInfo[uStreamPID].uStreamType = uStreamType;
+                }
+
                 switch (uStreamType)
                 {
                     case ES_STREAM_H264:
                         if (! pTsDemuxer->uVideoPID) pTsDemuxer->uVideoPID = uStreamPID;
-                        OUT("PID %u: PMT table, video stream type 0x%02X PID %u\n", uPID, uStreamType, uStreamPID);
+                        if (! pTsDemuxer->uQuiet)    OUT("PID %u: PMT table, video stream type 0x%02X PID %u\n", uPID, uStreamType, uStreamPID);
                         break;
 
                     case ES_STREAM_ADTS_AAC:
                         if (! pTsDemuxer->uAudioPID) pTsDemuxer->uAudioPID = uStreamPID;
-                        OUT("PID %u: PMT table, audio stream type 0x%02X PID %u\n", uPID, uStreamType, uStreamPID);
+                        if (! pTsDemuxer->uQuiet)    OUT("PID %u: PMT table, audio stream type 0x%02X PID %u\n", uPID, uStreamType, uStreamPID);
                         break;
 
                     default:
-                        OUT("PID %u: PMT table, stream type 0x%02X PID %u\n", uPID, uStreamType, uStreamPID);
+                        if (! pTsDemuxer->uQuiet)    OUT("PID %u: PMT table, stream type 0x%02X PID %u\n", uPID, uStreamType, uStreamPID);
                         break;
                 }
 
@@ -325,6 +466,9 @@ static int _ts_demuxer_parse_pmt(TS_DEMUXER* pTsDemuxer, unsigned char* pPayload
         }
     }
 
+    if (pTsDemuxer->eMode != TS_MODE_DEMUX)
+        return EXIT_SUCCESS;
+
     // Special requirements: TS file must include both types of data - video and audio
     if (! pTsDemuxer->uVideoPID)
     {
@@ -350,8 +494,8 @@ static int _ts_demuxer_parse_payload(TS_DEMUXER*    pTsDemuxer,
 {
     P_ES_OUTPUT pOutput = BAD_ES_OUTPUT;
 
-    DBG("%08X : Payload (%u bytes, %02X %02X %02X %02X), PID %u, Unit start %u, Continuity %u\n",
-        pTsDemuxer->uFileOffset,
+    DBG("%08llX : Payload (%u bytes, %02X %02X %02X %02X), PID %u, Unit start %u, Continuity %u\n",
+        pTsDemuxer->lluFileOffset,
         uPayloadLen,
         pPayload[0], pPayload[1], pPayload[2], pPayload[3],
         uPID,
@@ -360,21 +504,36 @@ static int _ts_demuxer_parse_payload(TS_DEMUXER*    pTsDemuxer,
 
     if (uPayloadLen < 1)
     {
-        ERR("%08X : Incorrect payload length (%u bytes)\n", pTsDemuxer->uFileOffset, uPayloadLen);
+        ERR("%08llX : Incorrect payload length (%u bytes)\n", pTsDemuxer->lluFileOffset, uPayloadLen);
         return EXIT_FAILURE;
     }
 
     if (uUnitStart)
     {
+        // Live streams repeat the tables all the time, only the first ones are parsed
+        unsigned int uLive = (pTsDemuxer->eMode == TS_MODE_LIVE);
+
         if (uPID == TS_PID_PAT)
         {
             // Program association table (PAT)
-            return _ts_demuxer_parse_pat(pTsDemuxer, pPayload, uPayloadLen, uPID);
+            return ((uLive) && (pTsDemuxer->uPMT_PID > 0))
+                   ? EXIT_SUCCESS
+                   : _ts_demuxer_parse_pat(pTsDemuxer, pPayload, uPayloadLen, uPID);
         }
         else if ((pTsDemuxer->uPMT_PID > 0) && (uPID == pTsDemuxer->uPMT_PID))
         {
-            // Program map table (PMT)
-            return _ts_demuxer_parse_pmt(pTsDemuxer, pPayload, uPayloadLen, uPID);
+            // Program map table (PMT), repetitions of the same version are skipped
+            unsigned int uVersion = (uPayloadLen > 6) ? ((pPayload[6] & 0x3E) >> 1) : PSI_VERSION_NONE;
+
+            if ((uLive) && (((pTsDemuxer->uVideoPID > 0) && (pTsDemuxer->uAudioPID > 0)) || (uVersion == pTsDemuxer->uPMT_Version)))
+                return EXIT_SUCCESS;
+
+            if (_ts_demuxer_parse_pmt(pTsDemuxer, pPayload, uPayloadLen, uPID) != EXIT_SUCCESS)
+                return EXIT_FAILURE;
+
+            pTsDemuxer->uPMT_Version = uVersion;
+
+            return EXIT_SUCCESS;
         }
     }
 
@@ -389,6 +548,113 @@ static int _ts_demuxer_parse_payload(TS_DEMUXER*    pTsDemuxer,
            : EXIT_SUCCESS;
 }
 
+static unsigned int _ts_demuxer_checkpoint_pid(TS_DEMUXER* pTsDemuxer)
+{
+    if (pTsDemuxer->pVideoOutput != BAD_ES_OUTPUT)
+        return pTsDemuxer->uVideoPID;
+
+    if (pTsDemuxer->pAudioOutput != BAD_ES_OUTPUT)
+        return pTsDemuxer->uAudioPID;
+
+    return 0;
+}
+
+static unsigned int _ts_demuxer_checkpoint_hash(unsigned char* pPacket, unsigned int uPacketSize)
+{
+    // 32-bit FNV-1a
+    unsigned int uHash = 0x811C9DC5;
+
+    for ( ; (uPacketSize > 0) ; uPacketSize --)
+        uHash = (uHash ^ *pPacket++) * 0x01000193;
+
+    return uHash;
+}
+
+static int _ts_demuxer_save_checkpoint(TS_DEMUXER* pTsDemuxer, unsigned char* pPacket, unsigned long long lluOffset)
+{
+    char pTmpName[CHECKPOINT_NAME_MAX];
+
+    P_ES_OUTPUT  pOutputs[ES_OUTPUT_MAX_NUM] = { pTsDemuxer->pVideoOutput, pTsDemuxer->pAudioOutput };
+    unsigned int uPIDs[ES_OUTPUT_MAX_NUM]    = { pTsDemuxer->uVideoPID,    pTsDemuxer->uAudioPID    };
+    unsigned int i;
+
+    // Reassembled PES of the main stream ends here, other outputs must not be inside PES
+    for (i = 0; i < ES_OUTPUT_MAX_NUM; i ++)
+    {
+        unsigned int uPending = 0;
+
+        if (pOutputs[i] == BAD_ES_OUTPUT)
+            continue;
+
+        if ((uPIDs[i] == _ts_demuxer_checkpoint_pid(pTsDemuxer)) && (es_output_flush(pOutputs[i]) != EXIT_SUCCESS))
+            return EXIT_FAILURE;
+
+        if (es_output_get_state(pOutputs[i], NULL, NULL, NULL, &uPending) != EXIT_SUCCESS)
+            return EXIT_FAILURE;
+
+        if (uPending > 0)
+        {
+            DBG("%08llX : Checkpoint is postponed, %s PES is incomplete\n", pTsDemuxer->lluFileOffset, es_output_type_str((ES_OUTPUT_TYPE) i));
+            return EXIT_SUCCESS;
+        }
+    }
+
+    snprintf(pTmpName, sizeof(pTmpName), "%s.tmp", pTsDemuxer->pCheckpointName);
+
+    FILE* pFile = fopen(pTmpName, "w");
+
+    if (! pFile)
+    {
+        ERR("Cannot create checkpoint file \"%s\"\n", pTmpName);
+        return EXIT_FAILURE;
+    }
+
+    // Input position is described by the offset and the hash of the packet located there
+    fprintf(pFile, "TS_DEMUXER_CHECKPOINT %u\n", CHECKPOINT_VERSION);
+    fprintf(pFile, "input %u %llu %u %08X\n",
+            pTsDemuxer->uPacketSize,
+            lluOffset,
+            pTsDemuxer->uPacketsNum,
+            _ts_demuxer_checkpoint_hash(pPacket, pTsDemuxer->uPacketSize));
+    fprintf(pFile, "pids %u %u %u %u\n",
+            pTsDemuxer->uPMT_PID,
+            pTsDemuxer->uPCR_PID,
+            pTsDemuxer->uVideoPID,
+            pTsDemuxer->uAudioPID);
+
+    // Output state is flushed to files before it is saved
+    for (i = 0; i < ES_OUTPUT_MAX_NUM; i ++)
+    {
+        unsigned int       uPacketsNum = 0;
+        unsigned int       uContinuity = 0;
+        unsigned long long lluLength   = 0;
+
+        if (pOutputs[i] == BAD_ES_OUTPUT)
+            continue;
+
+        if (es_output_get_state(pOutputs[i], &uPacketsNum, &uContinuity, &lluLength, NULL) != EXIT_SUCCESS)
+        {
+            fclose(pFile);
+            return EXIT_FAILURE;
+        }
+
+        fprintf(pFile, "output %u %u %u %llu\n", i, uPacketsNum, uContinuity, lluLength);
+    }
+
+    // Checkpoint file is replaced atomically
+    if ((fclose(pFile) != 0)
+    ||  (rename(pTmpName, pTsDemuxer->pCheckpointName) < 0))
+    {
+        ERR("Cannot write checkpoint file \"%s\"\n", pTsDemuxer->pCheckpointName);
+        return EXIT_FAILURE;
+    }
+
+    DBG("%08llX : Checkpoint at offset %llu\n", pTsDemuxer->lluFileOffset, lluOffset);
+
+    pTsDemuxer->lluCheckpointLast = lluOffset;
+    return EXIT_SUCCESS;
+}
+
 static int _ts_demuxer_parse_packet(TS_DEMUXER* pTsDemuxer, unsigned char* pPacket, unsigned int uRest)
 {
     for ( ; ; )
@@ -398,7 +664,7 @@ static int _ts_demuxer_parse_packet(TS_DEMUXER* pTsDemuxer, unsigned char* pPack
 
         if (pPacket[0] != TS_SYNC_CODE)
         {
-            ERR("%08X : Sync byte was not found (0x%02X)\n", pTsDemuxer->uFileOffset, pPacket[0]);
+            ERR("%08llX : Sync byte was not found (0x%02X)\n", pTsDemuxer->lluFileOffset, pPacket[0]);
             return EXIT_FAILURE;
         }
         else
@@ -420,6 +686,16 @@ static int _ts_demuxer_parse_packet(TS_DEMUXER* pTsDemuxer, unsigned char* pPack
             unsigned int uFieldCtrl  = (pPacket[3] & 0x30) >> 4;
             unsigned int uContinuity = (pPacket[3] & 0x0F);
 
+            // Checkpoint is taken right before new PES of the main output stream, so resume always restarts at its PES boundary
+            if ((pTsDemuxer->pCheckpointName) && (uUnitStart) && (uPID == _ts_demuxer_checkpoint_pid(pTsDemuxer)))
+            {
+                unsigned long long lluOffset = pTsDemuxer->lluBufferEnd - uRest;
+
+                if (((lluOffset - pTsDemuxer->lluCheckpointLast) >= pTsDemuxer->lluCheckpointStep)
+                &&  (_ts_demuxer_save_checkpoint(pTsDemuxer, pPacket, lluOffset) != EXIT_SUCCESS))
+                    return EXIT_FAILURE;
+            }
+
             switch(uFieldCtrl)
             {
                 case TS_PAYLOAD_ONLY:
@@ -440,7 +716,7 @@ static int _ts_demuxer_parse_packet(TS_DEMUXER* pTsDemuxer, unsigned char* pPack
                     break;
 
                 default:
-                    ERR("%08X : Incorrect adaptation field control value (0x%02X)\n", pTsDemuxer->uFileOffset, uFieldCtrl);
+                    ERR("%08llX : Incorrect adaptation field control value (0x%02X)\n", pTsDemuxer->lluFileOffset, uFieldCtrl);
                     return EXIT_FAILURE;
             }
 
@@ -452,7 +728,7 @@ static int _ts_demuxer_parse_packet(TS_DEMUXER* pTsDemuxer, unsigned char* pPack
         }
 
         pTsDemuxer->uPacketsNum += 1;
-        pTsDemuxer->uFileOffset += pTsDemuxer->uPacketSize;
+        pTsDemuxer->lluFileOffset += pTsDemuxer->uPacketSize;
 
         uRest   -= pTsDemuxer->uPacketSize;
         pPacket += pTsDemuxer->uPacketSize;
@@ -461,134 +737,1660 @@ static int _ts_demuxer_parse_packet(TS_DEMUXER* pTsDemuxer, unsigned char* pPack
     return EXIT_SUCCESS;
 }
 
-P_TS_DEMUXER ts_demuxer_create(const char* pFileName)
+static const char* _ts_demuxer_stream_type_str(unsigned int uStreamType)
 {
-    // Opening of input file
-    FILE* pFile = fopen(pFileName, "rb");
-
-    if (! pFile)
-        return BAD_TS_DEMUXER;
-
-    // Get file parameters
-    unsigned int uFileOffset = 0;
-    unsigned int uPacketSize = 0;
-
-    if (_ts_demuxer_get_file_info(pFile, &uFileOffset, &uPacketSize) != EXIT_SUCCESS)
+    switch (uStreamType)
     {
-        fclose(pFile);
-        return BAD_TS_DEMUXER;
+        case 0x01:               return "MPEG-1 video";
+        case 0x02:               return "MPEG-2 video";
+        case 0x03:               return "MPEG-1 audio";
+        case 0x04:               return "MPEG-2 audio";
+        case 0x06:               return "Private PES";
+        case ES_STREAM_ADTS_AAC: return "AAC (ADTS)";
+        case 0x11:               return "AAC (LATM)";
+        case ES_STREAM_H264:     return "H.264";
+        case 0x24:               return "H.265";
+        case 0x81:               return "AC-3";
+        default:                 return "Unknown";
     }
+}
 
-    // Memory allocation for TS description struct and filling it
-    TS_DEMUXER* pTsDemuxer = (TS_DEMUXER*) malloc(sizeof(TS_DEMUXER));
+static int _ts_demuxer_scan_packet(TS_DEMUXER* pTsDemuxer, unsigned char* pPacket, unsigned int uRest)
+{
+    unsigned int uPacketSize = pTsDemuxer->uPacketSize;
+    unsigned int uPrefetch   = uPacketSize * TS_SCAN_PREFETCH;
 
-    if (! pTsDemuxer)
+    for ( ; (uRest >= uPacketSize) ; )
     {
-        fclose(pFile);
-        return BAD_TS_DEMUXER;
-    }
+        // Only the header of each packet is touched, so fetch the packets ahead before they are needed
+        if (uRest > uPrefetch)
+            __builtin_prefetch(pPacket + uPrefetch);
 
-    OUT("Input TS file     : \"%s\"\n",   pFileName);
-    OUT("Initial offset    : %u bytes\n", uFileOffset);
-    OUT("Packet size       : %u bytes\n", uPacketSize);
+        if (pPacket[0] != TS_SYNC_CODE)
+        {
+            ERR("%08llX : Sync byte was not found (0x%02X)\n", pTsDemuxer->lluFileOffset, pPacket[0]);
+            return EXIT_FAILURE;
+        }
+        else
+        {
+            unsigned int uUnitStart  = (pPacket[1] & 0x40) ? 1 : 0;
+            unsigned int uPID        = (pPacket[1] & 0x1F) << 8;
+                         uPID       |=  pPacket[2];
+            unsigned int uFieldCtrl  = (pPacket[3] & 0x30) >> 4;
+            unsigned int uContinuity = (pPacket[3] & 0x0F);
 
-    pTsDemuxer->pFileName    = pFileName;
-    pTsDemuxer->pFile        = pFile;
-    pTsDemuxer->uFileOffset  = uFileOffset;
-    pTsDemuxer->uPacketSize  = uPacketSize;
-    pTsDemuxer->uPacketsNum  = 0;
-    pTsDemuxer->uPMT_PID     = 0;
-    pTsDemuxer->uPCR_PID     = 0;
-    pTsDemuxer->uVideoPID    = 0;
-    pTsDemuxer->uAudioPID    = 0;
-    pTsDemuxer->pVideoOutput = BAD_ES_OUTPUT;
-    pTsDemuxer->pAudioOutput = BAD_ES_OUTPUT;
+            unsigned int uDiscontinuity = 0;
+            unsigned int uHeaderLen     = 4;
 
-    // Return the pointer to TS description struct
-    return (P_TS_DEMUXER) pTsDemuxer;
+            TS_PID_INFO* pPidInfo = &pTsDemuxer->pPidInfo[uPID];
+
+            if (! uFieldCtrl)
+            {
+                ERR("%08llX : Incorrect adaptation field control value (0x%02X)\n", pTsDemuxer->lluFileOffset, uFieldCtrl);
+                return EXIT_FAILURE;
+            }
+
+            // Adaptation field: discontinuity indicator and PCR only
+            if (uFieldCtrl & TS_ADAPT_FIELD_ONLY)
+            {
+                unsigned int uAdaptLen = pPacket[4];
+
+                if ((uAdaptLen + 5) > uPacketSize)
+                {
+                    ERR("%08llX : Incorrect adaptation field length (%u bytes)\n", pTsDemuxer->lluFileOffset, uAdaptLen);
+                    return EXIT_FAILURE;
+                }
+
+                if (uAdaptLen > 0)
+                {
+                    uDiscontinuity = pPacket[5] & TS_AF_DISCONTINUITY;
+
+                    if ((pPacket[5] & TS_AF_PCR) && (uAdaptLen > 6))
+                    {
+                        pPidInfo->lluLastPCR = _ts_demuxer_get_pcr(pPacket + 5);
+
+                        if (! (pPidInfo->uFlags & TS_PID_FLAG_HAS_PCR))
+                            pPidInfo->lluFirstPCR = pPidInfo->lluLastPCR;
+
+                        pPidInfo->uFlags |= TS_PID_FLAG_HAS_PCR;
+                    }
+                }
+
+                uHeaderLen += (uAdaptLen + 1);
+            }
+
+            if ((uFieldCtrl & TS_PAYLOAD_ONLY) && (uPID != TS_PID_NULL))
+            {
+                // Continuity counter checking (duplicated packets are allowed)
+                if ((pPidInfo->uFlags & TS_PID_FLAG_PAYLOAD)
+                &&  (! uDiscontinuity)
+                &&  (uContinuity != pPidInfo->uContinuity)
+                &&  (uContinuity != ((pPidInfo->uContinuity + 1) & 0x0F)))
+                {
+                    DBG("%08llX : PID %u, incorrect continuity value (%u)\n", pTsDemuxer->lluFileOffset, uPID, uContinuity);
+                    pPidInfo->uErrorsNum += 1;
+                }
+
+                pPidInfo->uFlags     |= TS_PID_FLAG_PAYLOAD;
+                pPidInfo->uContinuity = uContinuity;
+
+                // First PTS of elementary stream
+                if ((uUnitStart) && (uHeaderLen < uPacketSize) && ((pPidInfo->uFlags & (TS_PID_FLAG_ES | TS_PID_FLAG_HAS_PTS)) == TS_PID_FLAG_ES))
+                {
+                    if (_ts_demuxer_get_pes_pts(pPacket + uHeaderLen, uPacketSize - uHeaderLen, &pPidInfo->lluFirstPTS) == EXIT_SUCCESS)
+                        pPidInfo->uFlags |= TS_PID_FLAG_HAS_PTS;
+                }
+
+                // Program specific information is parsed once per table
+                if ((uUnitStart) && (uHeaderLen < uPacketSize) && (! (pPidInfo->uFlags & TS_PID_FLAG_PARSED)))
+                {
+                    if (uPID == TS_PID_PAT)
+                    {
+                        if (_ts_demuxer_parse_pat(pTsDemuxer, pPacket + uHeaderLen, uPacketSize - uHeaderLen, uPID) == EXIT_SUCCESS)
+                            pPidInfo->uFlags |= TS_PID_FLAG_PARSED;
+                    }
+                    else if (pPidInfo->uFlags & TS_PID_FLAG_PMT)
+                    {
+                        if (_ts_demuxer_parse_pmt(pTsDemuxer, pPacket + uHeaderLen, uPacketSize - uHeaderLen, uPID) == EXIT_SUCCESS)
+                            pPidInfo->uFlags |= TS_PID_FLAG_PARSED;
+                    }
+                }
+            }
+
+            pPidInfo->uPacketsNum += 1;
+        }
+
+        pTsDemuxer->uPacketsNum += 1;
+        pTsDemuxer->lluFileOffset += uPacketSize;
+
+        uRest   -= uPacketSize;
+        pPacket += uPacketSize;
+    }
+
+    return EXIT_SUCCESS;
 }
 
-void ts_demuxer_free(P_TS_DEMUXER pDemuxer)
+static unsigned long long _ts_demuxer_pcr_distance(unsigned long long lluFirstPCR, unsigned long long lluLastPCR)
 {
-    TS_DEMUXER* pTsDemuxer = (TS_DEMUXER*) pDemuxer;
+    // 33-bit PCR base wraps around once in about 26.5 hours
+    return (lluLastPCR >= lluFirstPCR) ? (lluLastPCR - lluFirstPCR) : (lluLastPCR + PCR_WRAP_90KHZ - lluFirstPCR);
+}
 
-    if (pTsDemuxer)
+static void _ts_demuxer_scan_report(TS_DEMUXER* pTsDemuxer)
+{
+    unsigned int uPID;
+
+    for (uPID = 0; uPID < TS_PID_NUM; uPID ++)
     {
-        if (pTsDemuxer->pVideoOutput != BAD_ES_OUTPUT)
-            es_output_free(pTsDemuxer->pVideoOutput);
+        TS_PID_INFO* pPidInfo = &pTsDemuxer->pPidInfo[uPID];
+        const char*  pType    = NULL;
 
-        if (pTsDemuxer->pAudioOutput != BAD_ES_OUTPUT)
-            es_output_free(pTsDemuxer->pAudioOutput);
+        if (! pPidInfo->uPacketsNum)
+            continue;
 
-        if (pTsDemuxer->pFile)
-            fclose(pTsDemuxer->pFile);
+             if (uPID == TS_PID_PAT)                  pType = "PAT";
+        else if (uPID == TS_PID_NULL)                 pType = "Null";
+        else if (pPidInfo->uFlags & TS_PID_FLAG_PMT)  pType = "PMT";
+        else if (pPidInfo->uFlags & TS_PID_FLAG_ES)   pType = _ts_demuxer_stream_type_str(pPidInfo->uStreamType);
+        else                                          pType = "Unknown";
 
-        free(pTsDemuxer);
+        if (pPidInfo->uFlags & TS_PID_FLAG_ES)
+            OUT("PID %u: %s, stream type 0x%02X, %u packets, %u CC errors\n", uPID, pType, pPidInfo->uStreamType, pPidInfo->uPacketsNum, pPidInfo->uErrorsNum);
+        else
+            OUT("PID %u: %s, %u packets, %u CC errors\n", uPID, pType, pPidInfo->uPacketsNum, pPidInfo->uErrorsNum);
+    }
+
+    if ((pTsDemuxer->uPCR_PID > 0) && (pTsDemuxer->pPidInfo[pTsDemuxer->uPCR_PID].uFlags & TS_PID_FLAG_HAS_PCR))
+    {
+        TS_PID_INFO*       pPidInfo  = &pTsDemuxer->pPidInfo[pTsDemuxer->uPCR_PID];
+        unsigned long long lluLength = _ts_demuxer_pcr_distance(pPidInfo->lluFirstPCR, pPidInfo->lluLastPCR);
+
+        OUT("Duration          : %llu.%03llu seconds (PCR PID %u)\n", lluLength / 90000, (lluLength % 90000) / 90, pTsDemuxer->uPCR_PID);
     }
 }
 
-int ts_demuxer_add_output(P_TS_DEMUXER pDemuxer, ES_OUTPUT_TYPE eOutType, const char* pFileName)
+static int _ts_demuxer_segment_open(TS_DEMUXER* pTsDemuxer, TS_SEGMENTER* pSegmenter)
 {
-    P_ES_OUTPUT* ppOutput   = NULL;
-    TS_DEMUXER*  pTsDemuxer = (TS_DEMUXER*) pDemuxer;
+    char pSegmentName[SEGMENT_NAME_MAX];
 
-    if (! pTsDemuxer)
-        return EXIT_FAILURE;
+    snprintf(pSegmentName, sizeof(pSegmentName), "%s%05u.ts", pSegmenter->pPrefix, pSegmenter->uIndex);
 
-    switch (eOutType)
+    pSegmenter->pFile = fopen(pSegmentName, "wb");
+
+    if (! pSegmenter->pFile)
     {
-        case ES_OUTPUT_VIDEO: ppOutput = &pTsDemuxer->pVideoOutput; break;
-        case ES_OUTPUT_AUDIO: ppOutput = &pTsDemuxer->pAudioOutput; break;
-        default:                                                    break;
+        ERR("Cannot create segment file \"%s\"\n", pSegmentName);
+        return EXIT_FAILURE;
     }
 
-    if (! ppOutput)
-        return EXIT_FAILURE;
+    // Packet runs are written directly from the input buffer
+    setvbuf(pSegmenter->pFile, NULL, _IONBF, 0);
 
-    if (*ppOutput != BAD_ES_OUTPUT)
+    // Each segment except the first one starts with the last seen PAT and PMT.
+    // They are exact copies with the same continuity counter, so the original tables which follow remain continuous.
+    if ((pSegmenter->uIndex > 0)
+    && ((fwrite(pSegmenter->pPatPacket, 1, pTsDemuxer->uPacketSize, pSegmenter->pFile) != pTsDemuxer->uPacketSize)
+    ||  (fwrite(pSegmenter->pPmtPacket, 1, pTsDemuxer->uPacketSize, pSegmenter->pFile) != pTsDemuxer->uPacketSize)))
     {
-        const char* pOutType = es_output_type_str(eOutType);
-        ERR("%s output already exists\n", pOutType);
+        ERR("Cannot write segment file \"%s\"\n", pSegmentName);
         return EXIT_FAILURE;
     }
 
-    *ppOutput = es_output_create(pFileName, eOutType);
-
-    return (*ppOutput != BAD_ES_OUTPUT) ? EXIT_SUCCESS : EXIT_FAILURE;
+    DBG("%08llX : Segment %u started\n", pTsDemuxer->lluFileOffset, pSegmenter->uIndex);
+    return EXIT_SUCCESS;
 }
 
-int ts_demuxer_start(P_TS_DEMUXER pDemuxer)
+static int _ts_demuxer_segment_close(TS_SEGMENTER* pSegmenter, unsigned long long lluEndPTS)
 {
-    TS_DEMUXER* pTsDemuxer = (TS_DEMUXER*) pDemuxer;
+    unsigned long long lluDuration = 0;
 
-    if (! pTsDemuxer)
-        return EXIT_FAILURE;
-
-    // Memory allocation for data buffer
-    unsigned int   uBufSize = pTsDemuxer->uPacketSize * 1024;
-    unsigned char* pBuffer  = (unsigned char*) malloc(uBufSize);
+    if (! pSegmenter->pFile)
+        return EXIT_SUCCESS;
 
-    if (! pBuffer)
-        return EXIT_FAILURE;
+    fclose(pSegmenter->pFile);
+    pSegmenter->pFile = NULL;
 
-    // Read data to buffer and process it
-    OUT("----------------------------------------\n");
+    if (pSegmenter->uStarted)
+        lluDuration = (lluEndPTS - pSegmenter->lluStartPTS) & (PCR_WRAP_90KHZ - 1);
 
-    for ( ; ; )
+    // Store segment duration for the playlist
+    if (pSegmenter->uIndex >= pSegmenter->uDurationsMax)
     {
-        unsigned int uRead = fread(pBuffer, 1, uBufSize, pTsDemuxer->pFile);
+        unsigned int        uDurationsMax = pSegmenter->uDurationsMax ? (pSegmenter->uDurationsMax * 2) : 64;
+        unsigned long long* pDurations    = (unsigned long long*) realloc(pSegmenter->pDurations, uDurationsMax * sizeof(unsigned long long));
 
-        if (_ts_demuxer_parse_packet(pTsDemuxer, pBuffer, uRead) != EXIT_SUCCESS)
-            break;
+        if (! pDurations)
+            return EXIT_FAILURE;
 
-        if (uRead != uBufSize)
-            break;
+        pSegmenter->pDurations    = pDurations;
+        pSegmenter->uDurationsMax = uDurationsMax;
     }
 
-    // Release data buffer
-    free(pBuffer);
+    pSegmenter->pDurations[pSegmenter->uIndex] = lluDuration;
+    pSegmenter->uIndex += 1;
+
+    return EXIT_SUCCESS;
+}
+
+static int _ts_demuxer_segment_write(TS_SEGMENTER* pSegmenter, unsigned char* pData, unsigned int uLength)
+{
+    if ((uLength > 0) && (fwrite(pData, 1, uLength, pSegmenter->pFile) != uLength))
+    {
+        ERR("Cannot write segment %u\n", pSegmenter->uIndex);
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+static int _ts_demuxer_segment_playlist(TS_SEGMENTER* pSegmenter)
+{
+    char         pName[SEGMENT_NAME_MAX];
+    const char*  pBaseName      = strrchr(pSegmenter->pPrefix, '/');
+    unsigned int uTargetSeconds = 1;
+    unsigned int i;
+
+    pBaseName = pBaseName ? (pBaseName + 1) : pSegmenter->pPrefix;
+
+    snprintf(pName, sizeof(pName), "%s.m3u8", pSegmenter->pPrefix);
+
+    FILE* pFile = fopen(pName, "w");
+
+    if (! pFile)
+    {
+        ERR("Cannot create playlist file \"%s\"\n", pName);
+        return EXIT_FAILURE;
+    }
+
+    for (i = 0; i < pSegmenter->uIndex; i ++)
+    {
+        unsigned int uSeconds = (pSegmenter->pDurations[i] + 89999) / 90000;
+
+        if (uTargetSeconds < uSeconds)
+            uTargetSeconds = uSeconds;
+    }
+
+    fprintf(pFile, "#EXTM3U\n");
+    fprintf(pFile, "#EXT-X-VERSION:3\n");
+    fprintf(pFile, "#EXT-X-TARGETDURATION:%u\n", uTargetSeconds);
+    fprintf(pFile, "#EXT-X-MEDIA-SEQUENCE:0\n");
+
+    for (i = 0; i < pSegmenter->uIndex; i ++)
+    {
+        fprintf(pFile, "#EXTINF:%llu.%03llu,\n", pSegmenter->pDurations[i] / 90000, (pSegmenter->pDurations[i] % 90000) / 90);
+        fprintf(pFile, "%s%05u.ts\n", pBaseName, i);
+    }
+
+    fprintf(pFile, "#EXT-X-ENDLIST\n");
+    fclose(pFile);
+
+    OUT("Playlist file     : \"%s\"\n", pName);
+    return EXIT_SUCCESS;
+}
+
+static int _ts_demuxer_segment_packet(TS_DEMUXER* pTsDemuxer, TS_SEGMENTER* pSegmenter, unsigned char* pPacket, unsigned int uRest)
+{
+    unsigned int   uPacketSize = pTsDemuxer->uPacketSize;
+    unsigned char* pRunStart   = pPacket;
+
+    for ( ; (uRest >= uPacketSize) ; )
+    {
+        if (pPacket[0] != TS_SYNC_CODE)
+        {
+            ERR("%08llX : Sync byte was not found (0x%02X)\n", pTsDemuxer->lluFileOffset, pPacket[0]);
+            return EXIT_FAILURE;
+        }
+        else
+        {
+            unsigned int uUnitStart = (pPacket[1] & 0x40) ? 1 : 0;
+            unsigned int uPID       = (pPacket[1] & 0x1F) << 8;
+                         uPID      |=  pPacket[2];
+            unsigned int uFieldCtrl = (pPacket[3] & 0x30) >> 4;
+            unsigned int uAdaptLen  = (uFieldCtrl & TS_ADAPT_FIELD_ONLY) ? (pPacket[4] + 1) : 0;
+
+            unsigned char* pPayload    = pPacket     + (4 + uAdaptLen);
+            unsigned int   uPayloadLen = uPacketSize - (4 + uAdaptLen);
+
+            if ((uAdaptLen + 4) > uPacketSize)
+            {
+                ERR("%08llX : Incorrect adaptation field length (%u bytes)\n", pTsDemuxer->lluFileOffset, uAdaptLen - 1);
+                return EXIT_FAILURE;
+            }
+
+            if ((uUnitStart) && (uFieldCtrl & TS_PAYLOAD_ONLY) && (uPayloadLen > 0))
+            {
+                if (uPID == TS_PID_PAT)
+                {
+                    if ((! pTsDemuxer->uPMT_PID) && (_ts_demuxer_parse_pat(pTsDemuxer, pPayload, uPayloadLen, uPID) != EXIT_SUCCESS))
+                        return EXIT_FAILURE;
+
+                    memcpy(pSegmenter->pPatPacket, pPacket, uPacketSize);
+                }
+                else if ((pTsDemuxer->uPMT_PID > 0) && (uPID == pTsDemuxer->uPMT_PID))
+                {
+                    if ((! pTsDemuxer->uVideoPID) && (_ts_demuxer_parse_pmt(pTsDemuxer, pPayload, uPayloadLen, uPID) != EXIT_SUCCESS))
+                        return EXIT_FAILURE;
+
+                    memcpy(pSegmenter->pPmtPacket, pPacket, uPacketSize);
+                }
+                else if ((pTsDemuxer->uVideoPID > 0) && (uPID == pTsDemuxer->uVideoPID))
+                {
+                    unsigned int       uRandomAccess = ((uAdaptLen > 1) && (pPacket[5] & TS_AF_RANDOM_ACCESS)) ? 1 : 0;
+                    unsigned long long lluPTS        = 0;
+
+                    if (_ts_demuxer_get_pes_pts(pPayload, uPayloadLen, &lluPTS) == EXIT_SUCCESS)
+                    {
+                        if (! pSegmenter->uStarted)
+                        {
+                            pSegmenter->uStarted    = 1;
+                            pSegmenter->lluStartPTS = lluPTS;
+                        }
+                        else if ((uRandomAccess)
+                             &&  (pSegmenter->pPatPacket[0] == TS_SYNC_CODE)
+                             &&  (pSegmenter->pPmtPacket[0] == TS_SYNC_CODE)
+                             && (((lluPTS - pSegmenter->lluStartPTS) & (PCR_WRAP_90KHZ - 1)) >= pSegmenter->lluTarget))
+                        {
+                            // Keyframe after target duration: finish the run and switch to the next segment
+                            if ((_ts_demuxer_segment_write(pSegmenter, pRunStart, pPacket - pRunStart) != EXIT_SUCCESS)
+                            ||  (_ts_demuxer_segment_close(pSegmenter, lluPTS)                         != EXIT_SUCCESS)
+                            ||  (_ts_demuxer_segment_open(pTsDemuxer, pSegmenter)                      != EXIT_SUCCESS))
+                                return EXIT_FAILURE;
+
+                            pRunStart               = pPacket;
+                            pSegmenter->lluStartPTS = lluPTS;
+                        }
+
+                        pSegmenter->lluLastPTS = lluPTS;
+                    }
+                }
+            }
+        }
+
+        pTsDemuxer->uPacketsNum += 1;
+        pTsDemuxer->lluFileOffset += uPacketSize;
+
+        uRest   -= uPacketSize;
+        pPacket += uPacketSize;
+    }
+
+    return _ts_demuxer_segment_write(pSegmenter, pRunStart, pPacket - pRunStart);
+}
+
+static int _ts_demuxer_wait_growth(TS_DEMUXER* pTsDemuxer, int nNotifyFd)
+{
+    char          pEvents[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+    struct pollfd tPoll;
+
+    tPoll.fd      = nNotifyFd;
+    tPoll.events  = POLLIN;
+    tPoll.revents = 0;
+
+    if (poll(&tPoll, 1, (int) pTsDemuxer->uFollowTimeout) <= 0)
+    {
+        OUT("Input file was idle for %u ms\n", pTsDemuxer->uFollowTimeout);
+        return EXIT_FAILURE;
+    }
+
+    // Drain all pending events, the file is read until EOF anyway
+    ssize_t nRead = read(nNotifyFd, pEvents, sizeof(pEvents));
+    char*   pPos  = pEvents;
+
+    for ( ; (nRead > 0) && (pPos < (pEvents + nRead)) ; )
+    {
+        struct inotify_event* pEvent = (struct inotify_event*) pPos;
+
+        // Data written before removal or renaming is still read
+        if (pEvent->mask & (IN_DELETE_SELF | IN_MOVE_SELF))
+            pTsDemuxer->uFollowTimeout = 0;
+
+        pPos += sizeof(struct inotify_event) + pEvent->len;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+static int _ts_demuxer_packet_pcr(TS_DEMUXER* pTsDemuxer, unsigned char* pPacket, unsigned long long* pPCR)
+{
+    unsigned int uPID = ((pPacket[1] & 0x1F) << 8) | pPacket[2];
+
+    // PCR of the program is carried in adaptation field of PCR PID packets
+    if ((! pTsDemuxer->uPCR_PID)
+    ||  (uPID != pTsDemuxer->uPCR_PID)
+    || ((pPacket[3] & (TS_ADAPT_FIELD_ONLY << 4)) == 0)
+    ||  (pPacket[4] < 7)
+    || ((pPacket[5] & TS_AF_PCR) == 0))
+        return EXIT_FAILURE;
+
+    if (pPCR) *pPCR = _ts_demuxer_get_pcr(pPacket + 5);
+
+    return EXIT_SUCCESS;
+}
+
+static unsigned int _ts_demuxer_probe_complete(TS_DEMUXER* pTsDemuxer)
+{
+    unsigned int uPID;
+
+    // PAT, PCR of the program, every PMT and the first PTS of every elementary stream
+    if (! (pTsDemuxer->pPidInfo[TS_PID_PAT].uFlags & TS_PID_FLAG_PARSED))
+        return 0;
+
+    if ((! pTsDemuxer->uPCR_PID)
+    || ((pTsDemuxer->uPCR_PID != TS_PID_NULL) && (! (pTsDemuxer->pPidInfo[pTsDemuxer->uPCR_PID].uFlags & TS_PID_FLAG_HAS_PCR))))
+        return 0;
+
+    for (uPID = 0; uPID < TS_PID_NUM; uPID ++)
+    {
+        unsigned int uFlags = pTsDemuxer->pPidInfo[uPID].uFlags;
+
+        if (((uFlags & TS_PID_FLAG_PMT) && (! (uFlags & TS_PID_FLAG_PARSED)))
+        ||  ((uFlags & TS_PID_FLAG_ES)  && (! (uFlags & TS_PID_FLAG_HAS_PTS))))
+            return 0;
+    }
+
+    return 1;
+}
+
+static int _ts_demuxer_probe_tail(TS_DEMUXER* pTsDemuxer, unsigned long long* pLastPCR)
+{
+    unsigned int uPacketSize = pTsDemuxer->uPacketSize;
+    unsigned int uBufSize    = uPacketSize * PROBE_TAIL_PACKETS;
+    unsigned int uAlign      = 0;
+    unsigned int i;
+
+    // Last packets of the file (but not the ones already read), aligned to the packet grid found at the beginning
+    off_t nHeadEnd = ftello(pTsDemuxer->pFile);
+
+    if ((nHeadEnd < 0) || (fseeko(pTsDemuxer->pFile, 0, SEEK_END) < 0))
+        return EXIT_FAILURE;
+
+    off_t nSize  = ftello(pTsDemuxer->pFile);
+    off_t nStart = (nSize > (nHeadEnd + uBufSize)) ? (nSize - uBufSize) : nHeadEnd;
+
+    nStart -= (nStart - (off_t) pTsDemuxer->lluFileOffset) % uPacketSize;
+
+    unsigned char* pBuffer = (unsigned char*) malloc(uBufSize + uPacketSize);
+
+    if (! pBuffer)
+        return EXIT_FAILURE;
+
+    if (fseeko(pTsDemuxer->pFile, nStart, SEEK_SET) < 0)
+    {
+        free(pBuffer);
+        return EXIT_FAILURE;
+    }
+
+    unsigned int uRead = fread(pBuffer, 1, uBufSize + uPacketSize, pTsDemuxer->pFile);
+
+    // Packet grid may be shifted by damaged data in the middle of the file
+    for (uAlign = 0; uAlign < uPacketSize; uAlign ++)
+    {
+        if (((uAlign + uPacketSize) < uRead) && (pBuffer[uAlign] == TS_SYNC_CODE) && (pBuffer[uAlign + uPacketSize] == TS_SYNC_CODE))
+            break;
+    }
+
+    for (i = uAlign; (i + uPacketSize) <= uRead; i += uPacketSize)
+    {
+        if (pBuffer[i] == TS_SYNC_CODE)
+            _ts_demuxer_packet_pcr(pTsDemuxer, pBuffer + i, pLastPCR);
+    }
+
+    free(pBuffer);
+    return EXIT_SUCCESS;
+}
+
+static int _ts_demuxer_probe_file(TS_DEMUXER* pTsDemuxer, unsigned int uBudget, unsigned int uTimeLimit, TS_PROBE_INFO* pInfo)
+{
+    struct timespec    tStart;
+    struct timespec    tNow;
+    unsigned long long lluRead = 0;
+    unsigned int       uEnd    = 0;
+    unsigned int       uPID;
+
+    // Memory allocation for per-PID information
+    pTsDemuxer->pPidInfo = (TS_PID_INFO*) calloc(TS_PID_NUM, sizeof(TS_PID_INFO));
+
+    if (! pTsDemuxer->pPidInfo)
+        return EXIT_FAILURE;
+
+    pTsDemuxer->eMode  = TS_MODE_PROBE;
+    pTsDemuxer->uQuiet = 1;
+
+    // Small reads, so probing stops as soon as the stream layout is known
+    unsigned int   uBufSize = pTsDemuxer->uPacketSize * PROBE_CHUNK_PACKETS;
+    unsigned char* pBuffer  = (unsigned char*) malloc(uBufSize);
+
+    if (! pBuffer)
+        return EXIT_FAILURE;
+
+    clock_gettime(CLOCK_MONOTONIC, &tStart);
+
+    for ( ; ; )
+    {
+        unsigned int uRead = fread(pBuffer, 1, uBufSize, pTsDemuxer->pFile);
+
+        lluRead += uRead;
+
+        if (_ts_demuxer_scan_packet(pTsDemuxer, pBuffer, uRead) != EXIT_SUCCESS)
+        {
+            free(pBuffer);
+            return EXIT_FAILURE;
+        }
+
+        if ((pInfo->uComplete = _ts_demuxer_probe_complete(pTsDemuxer)))
+            break;
+
+        if (uRead != uBufSize)
+        {
+            uEnd = 1;
+            break;
+        }
+
+        if (lluRead >= uBudget)
+            break;
+
+        clock_gettime(CLOCK_MONOTONIC, &tNow);
+
+        if ((uTimeLimit > 0) && ((unsigned long long) ((tNow.tv_sec - tStart.tv_sec) * 1000 + (tNow.tv_nsec - tStart.tv_nsec) / 1000000) >= uTimeLimit))
+            break;
+    }
+
+    free(pBuffer);
+
+    // Results
+    pInfo->uPacketSize = pTsDemuxer->uPacketSize;
+    pInfo->uPCR_PID    = pTsDemuxer->uPCR_PID;
+    pInfo->uBytesRead  = (lluRead > UINT_MAX) ? UINT_MAX : (unsigned int) lluRead;
+
+    for (uPID = 0; (uPID < TS_PID_NUM) && (pInfo->uStreamsNum < TS_PROBE_STREAMS_MAX); uPID ++)
+    {
+        TS_PID_INFO*     pPidInfo = &pTsDemuxer->pPidInfo[uPID];
+        TS_PROBE_STREAM* pStream  = &pInfo->pStreams[pInfo->uStreamsNum];
+
+        if (! (pPidInfo->uFlags & TS_PID_FLAG_ES))
+            continue;
+
+        pStream->uPID        = uPID;
+        pStream->uStreamType = pPidInfo->uStreamType;
+        pStream->uHasPTS     = (pPidInfo->uFlags & TS_PID_FLAG_HAS_PTS) ? 1 : 0;
+        pStream->lluFirstPTS = pPidInfo->lluFirstPTS;
+
+        pInfo->uStreamsNum ++;
+    }
+
+    // Duration is estimated from the first PCR and the last PCR found in the tail of the file
+    if ((pTsDemuxer->uPCR_PID > 0) && (pTsDemuxer->pPidInfo[pTsDemuxer->uPCR_PID].uFlags & TS_PID_FLAG_HAS_PCR))
+    {
+        TS_PID_INFO*       pPidInfo   = &pTsDemuxer->pPidInfo[pTsDemuxer->uPCR_PID];
+        unsigned long long lluLastPCR = pPidInfo->lluLastPCR;
+
+        if ((! uEnd) && (_ts_demuxer_probe_tail(pTsDemuxer, &lluLastPCR) != EXIT_SUCCESS))
+            return EXIT_FAILURE;
+
+        pInfo->lluDuration = _ts_demuxer_pcr_distance(pPidInfo->lluFirstPCR, lluLastPCR);
+    }
+
+    return EXIT_SUCCESS;
+}
+
+// Cache line: size, mtime, results, streams and the real path of the file at the end
+static int _ts_demuxer_probe_cache_match(const char* pLine, const char* pPath)
+{
+    unsigned int uLineLen = strcspn(pLine, "\n");
+    unsigned int uPathLen = strlen(pPath);
+
+    // Path is compared first, so other entries are skipped without parsing
+    return ((uLineLen > uPathLen) && (pLine[uLineLen - uPathLen - 1] == ' ') && (! memcmp(pLine + uLineLen - uPathLen, pPath, uPathLen)));
+}
+
+static int _ts_demuxer_probe_cache_load(const char* pCacheName, const char* pPath, struct stat* pStat, TS_PROBE_INFO* pInfo)
+{
+    char pLine[PROBE_LINE_MAX];
+    int  nResult = EXIT_FAILURE;
+
+    FILE* pFile = fopen(pCacheName, "r");
+
+    if (! pFile)
+        return EXIT_FAILURE;
+
+    // Each path has one entry at most
+    for ( ; (fgets(pLine, sizeof(pLine), pFile)) ; )
+    {
+        unsigned long long lluSize = 0;
+        long long          llSec   = 0;
+        long               lNsec   = 0;
+        int                nPos    = 0;
+        int                nNext   = 0;
+        unsigned int       i;
+
+        if (! _ts_demuxer_probe_cache_match(pLine, pPath))
+            continue;
+
+        memset(pInfo, 0, sizeof(TS_PROBE_INFO));
+
+        if ((sscanf(pLine, "%llu %lld %ld %u %u %u %u %llu %u%n",
+                    &lluSize, &llSec, &lNsec,
+                    &pInfo->uPacketSize, &pInfo->uComplete, &pInfo->uBytesRead, &pInfo->uPCR_PID, &pInfo->lluDuration, &pInfo->uStreamsNum,
+                    &nPos) != 9)
+        ||  (lluSize != (unsigned long long) pStat->st_size)
+        ||  (llSec   != (long long) pStat->st_mtim.tv_sec)
+        ||  (lNsec   != (long) pStat->st_mtim.tv_nsec)
+        ||  (pInfo->uStreamsNum > TS_PROBE_STREAMS_MAX))
+            break;
+
+        for (i = 0; i < pInfo->uStreamsNum; i ++, nPos += nNext)
+        {
+            TS_PROBE_STREAM* pStream = &pInfo->pStreams[i];
+
+            if (sscanf(pLine + nPos, " %u %u %u %llu%n", &pStream->uPID, &pStream->uStreamType, &pStream->uHasPTS, &pStream->lluFirstPTS, &nNext) != 4)
+                break;
+        }
+
+        if ((i == pInfo->uStreamsNum) && (pLine[nPos] == ' ') && (pLine + nPos + 1 + strlen(pPath) == pLine + strcspn(pLine, "\n")))
+            nResult = EXIT_SUCCESS;
+
+        break;
+    }
+
+    fclose(pFile);
+    return nResult;
+}
+
+static int _ts_demuxer_probe_cache_save(const char* pCacheName, const char* pPath, struct stat* pStat, TS_PROBE_INFO* pInfo)
+{
+    char         pLine[PROBE_LINE_MAX];
+    char         pOldLine[PROBE_LINE_MAX];
+    char         pTempName[PATH_MAX];
+    unsigned int uLen = 0;
+    unsigned int i;
+
+    uLen += snprintf(pLine + uLen, sizeof(pLine) - uLen, "%llu %lld %ld %u %u %u %u %llu %u",
+                     (unsigned long long) pStat->st_size, (long long) pStat->st_mtim.tv_sec, (long) pStat->st_mtim.tv_nsec,
+                     pInfo->uPacketSize, pInfo->uComplete, pInfo->uBytesRead, pInfo->uPCR_PID, pInfo->lluDuration, pInfo->uStreamsNum);
+
+    for (i = 0; (i < pInfo->uStreamsNum) && (uLen < sizeof(pLine)); i ++)
+    {
+        TS_PROBE_STREAM* pStream = &pInfo->pStreams[i];
+
+        uLen += snprintf(pLine + uLen, sizeof(pLine) - uLen, " %u %u %u %llu", pStream->uPID, pStream->uStreamType, pStream->uHasPTS, pStream->lluFirstPTS);
+    }
+
+    if (uLen < sizeof(pLine))
+        uLen += snprintf(pLine + uLen, sizeof(pLine) - uLen, " %s\n", pPath);
+
+    if ((uLen >= sizeof(pLine)) || ((unsigned int) snprintf(pTempName, sizeof(pTempName), "%s.XXXXXX", pCacheName) >= sizeof(pTempName)))
+        return EXIT_FAILURE;
+
+    // New cache is written aside and renamed over the old one, so readers always see a whole file
+    int   nFd   = mkstemp(pTempName);
+    FILE* pTemp = (nFd >= 0) ? fdopen(nFd, "w") : NULL;
+
+    if (! pTemp)
+    {
+        ERR("Cannot write probe cache \"%s\"\n", pCacheName);
+
+        if (nFd >= 0)
+        {
+            close(nFd);
+            remove(pTempName);
+        }
+
+        return EXIT_FAILURE;
+    }
+
+    FILE* pOld = fopen(pCacheName, "r");
+
+    // Old entry of the same path is replaced
+    for ( ; (pOld) && (fgets(pOldLine, sizeof(pOldLine), pOld)) ; )
+    {
+        if (! _ts_demuxer_probe_cache_match(pOldLine, pPath))
+            fputs(pOldLine, pTemp);
+    }
+
+    if (pOld)
+        fclose(pOld);
+
+    fputs(pLine, pTemp);
+
+    if ((fchmod(nFd, 0644) < 0) || (fclose(pTemp) != 0) || (rename(pTempName, pCacheName) < 0))
+    {
+        ERR("Cannot write probe cache \"%s\"\n", pCacheName);
+        remove(pTempName);
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+static void _ts_demuxer_probe_report(TS_PROBE_INFO* pInfo)
+{
+    unsigned int i;
+
+    OUT("----------------------------------------\n");
+    OUT("Probe             : %s, %u bytes read\n", pInfo->uComplete ? "complete" : "incomplete", pInfo->uBytesRead);
+
+    for (i = 0; i < pInfo->uStreamsNum; i ++)
+    {
+        TS_PROBE_STREAM* pStream = &pInfo->pStreams[i];
+        const char*      pType   = _ts_demuxer_stream_type_str(pStream->uStreamType);
+
+        if (pStream->uHasPTS)
+            OUT("PID %u: %s, stream type 0x%02X, first PTS %llu\n", pStream->uPID, pType, pStream->uStreamType, pStream->lluFirstPTS);
+        else
+            OUT("PID %u: %s, stream type 0x%02X, no PTS\n", pStream->uPID, pType, pStream->uStreamType);
+    }
+
+    if (pInfo->lluDuration > 0)
+        OUT("Duration          : %llu.%03llu seconds (PCR PID %u)\n", pInfo->lluDuration / 90000, (pInfo->lluDuration % 90000) / 90, pInfo->uPCR_PID);
+}
+
+P_TS_DEMUXER ts_demuxer_create(const char* pFileName)
+{
+    // Opening of input file
+    FILE* pFile = fopen(pFileName, "rb");
+
+    if (! pFile)
+        return BAD_TS_DEMUXER;
+
+    // Get file parameters
+    unsigned int uFileOffset = 0;
+    unsigned int uPacketSize = 0;
+
+    if (_ts_demuxer_get_file_info(pFile, &uFileOffset, &uPacketSize) != EXIT_SUCCESS)
+    {
+        fclose(pFile);
+        return BAD_TS_DEMUXER;
+    }
+
+    // Memory allocation for TS description struct and filling it
+    TS_DEMUXER* pTsDemuxer = (TS_DEMUXER*) malloc(sizeof(TS_DEMUXER));
+
+    if (! pTsDemuxer)
+    {
+        fclose(pFile);
+        return BAD_TS_DEMUXER;
+    }
+
+    OUT("Input TS file     : \"%s\"\n",   pFileName);
+    OUT("Initial offset    : %u bytes\n", uFileOffset);
+    OUT("Packet size       : %u bytes\n", uPacketSize);
+
+    pTsDemuxer->pFileName    = pFileName;
+    pTsDemuxer->pFile        = pFile;
+    pTsDemuxer->lluFileOffset = uFileOffset;
+    pTsDemuxer->uPacketSize  = uPacketSize;
+    pTsDemuxer->uPacketsNum  = 0;
+    pTsDemuxer->uPMT_PID     = 0;
+    pTsDemuxer->uPMT_Version = PSI_VERSION_NONE;
+    pTsDemuxer->uPCR_PID     = 0;
+    pTsDemuxer->uVideoPID    = 0;
+    pTsDemuxer->uAudioPID    = 0;
+    pTsDemuxer->pVideoOutput = BAD_ES_OUTPUT;
+    pTsDemuxer->pAudioOutput = BAD_ES_OUTPUT;
+    pTsDemuxer->pTsOutput    = BAD_TS_OUTPUT;
+    pTsDemuxer->eMode        = TS_MODE_DEMUX;
+    pTsDemuxer->pPidInfo     = NULL;
+    pTsDemuxer->uQuiet       = 0;
+
+    pTsDemuxer->pCheckpointName   = NULL;
+    pTsDemuxer->lluCheckpointStep = 0;
+    pTsDemuxer->lluCheckpointLast = uFileOffset;
+    pTsDemuxer->lluBufferEnd      = uFileOffset;
+
+    pTsDemuxer->uFollowTimeout    = 0;
+    pTsDemuxer->uErrorsNum        = 0;
+
+    pTsDemuxer->pPesPool          = BAD_PES_POOL;
+
+    memset(pTsDemuxer->pFlush,      0, sizeof(pTsDemuxer->pFlush));
+    memset(pTsDemuxer->pFlushValue, 0, sizeof(pTsDemuxer->pFlushValue));
+
+    // Return the pointer to TS description struct
+    return (P_TS_DEMUXER) pTsDemuxer;
+}
+
+P_TS_DEMUXER ts_demuxer_create_live(const char* pName)
+{
+    // Memory allocation for TS description struct, live input has no file and is fed by ts_demuxer_parse_data()
+    TS_DEMUXER* pTsDemuxer = (TS_DEMUXER*) calloc(1, sizeof(TS_DEMUXER));
+
+    if (! pTsDemuxer)
+        return BAD_TS_DEMUXER;
+
+    OUT("Input TS stream   : \"%s\"\n", pName);
+
+    pTsDemuxer->pFileName    = pName;
+    pTsDemuxer->pFile        = NULL;
+    pTsDemuxer->uPacketSize  = TS_PACKET_SIZE_188;
+    pTsDemuxer->pVideoOutput = BAD_ES_OUTPUT;
+    pTsDemuxer->pAudioOutput = BAD_ES_OUTPUT;
+    pTsDemuxer->pTsOutput    = BAD_TS_OUTPUT;
+    pTsDemuxer->eMode        = TS_MODE_LIVE;
+    pTsDemuxer->pPesPool     = BAD_PES_POOL;
+    pTsDemuxer->uPMT_Version = PSI_VERSION_NONE;
+
+    // Return the pointer to TS description struct
+    return (P_TS_DEMUXER) pTsDemuxer;
+}
+
+void ts_demuxer_free(P_TS_DEMUXER pDemuxer)
+{
+    TS_DEMUXER* pTsDemuxer = (TS_DEMUXER*) pDemuxer;
+
+    if (pTsDemuxer)
+    {
+        if (pTsDemuxer->pVideoOutput != BAD_ES_OUTPUT)
+            es_output_free(pTsDemuxer->pVideoOutput);
+
+        if (pTsDemuxer->pAudioOutput != BAD_ES_OUTPUT)
+            es_output_free(pTsDemuxer->pAudioOutput);
+
+        if (pTsDemuxer->pTsOutput != BAD_TS_OUTPUT)
+            ts_output_free(pTsDemuxer->pTsOutput);
+
+        if (pTsDemuxer->pFile)
+            fclose(pTsDemuxer->pFile);
+
+        if (pTsDemuxer->pPidInfo)
+            free(pTsDemuxer->pPidInfo);
+
+        // Outputs return their buffers before the pool is released
+        if (pTsDemuxer->pPesPool != BAD_PES_POOL)
+            pes_pool_free(pTsDemuxer->pPesPool);
+
+        free(pTsDemuxer);
+    }
+}
+
+int ts_demuxer_add_output(P_TS_DEMUXER pDemuxer, ES_OUTPUT_TYPE eOutType, const char* pFileName)
+{
+    P_ES_OUTPUT* ppOutput   = NULL;
+    TS_DEMUXER*  pTsDemuxer = (TS_DEMUXER*) pDemuxer;
+
+    if (! pTsDemuxer)
+        return EXIT_FAILURE;
+
+    switch (eOutType)
+    {
+        case ES_OUTPUT_VIDEO: ppOutput = &pTsDemuxer->pVideoOutput; break;
+        case ES_OUTPUT_AUDIO: ppOutput = &pTsDemuxer->pAudioOutput; break;
+        default:                                                    break;
+    }
+
+    if (! ppOutput)
+        return EXIT_FAILURE;
+
+    if (*ppOutput != BAD_ES_OUTPUT)
+    {
+        const char* pOutType = es_output_type_str(eOutType);
+        ERR("%s output already exists\n", pOutType);
+        return EXIT_FAILURE;
+    }
+
+    *ppOutput = es_output_create(pFileName, eOutType);
+
+    if (*ppOutput == BAD_ES_OUTPUT)
+        return EXIT_FAILURE;
+
+    if (pTsDemuxer->eMode == TS_MODE_LIVE)
+        es_output_set_live(*ppOutput);
+
+    if (pTsDemuxer->pPesPool != BAD_PES_POOL)
+        es_output_set_pool(*ppOutput, pTsDemuxer->pPesPool);
+
+    if ((pTsDemuxer->pFlush[eOutType] != ES_FLUSH_NONE)
+    &&  (es_output_set_flush(*ppOutput, pTsDemuxer->pFlush[eOutType], pTsDemuxer->pFlushValue[eOutType]) != EXIT_SUCCESS))
+        return EXIT_FAILURE;
+
+    return EXIT_SUCCESS;
+}
+
+int ts_demuxer_set_reassembly(P_TS_DEMUXER pDemuxer, unsigned int uPoolLimit)
+{
+    TS_DEMUXER* pTsDemuxer = (TS_DEMUXER*) pDemuxer;
+
+    if ((! pTsDemuxer) || (pTsDemuxer->pPesPool != BAD_PES_POOL))
+        return EXIT_FAILURE;
+
+    pTsDemuxer->pPesPool = pes_pool_create(uPoolLimit);
+
+    if (pTsDemuxer->pPesPool == BAD_PES_POOL)
+        return EXIT_FAILURE;
+
+    // Outputs added before are switched to whole PES writing too
+    if ((pTsDemuxer->pVideoOutput != BAD_ES_OUTPUT) && (es_output_set_pool(pTsDemuxer->pVideoOutput, pTsDemuxer->pPesPool) != EXIT_SUCCESS))
+        return EXIT_FAILURE;
+
+    if ((pTsDemuxer->pAudioOutput != BAD_ES_OUTPUT) && (es_output_set_pool(pTsDemuxer->pAudioOutput, pTsDemuxer->pPesPool) != EXIT_SUCCESS))
+        return EXIT_FAILURE;
+
+    return EXIT_SUCCESS;
+}
+
+int ts_demuxer_set_flush(P_TS_DEMUXER pDemuxer, ES_OUTPUT_TYPE eOutType, ES_FLUSH_POLICY eFlush, unsigned int uValue)
+{
+    P_ES_OUTPUT pOutput    = BAD_ES_OUTPUT;
+    TS_DEMUXER* pTsDemuxer = (TS_DEMUXER*) pDemuxer;
+
+    if (! pTsDemuxer)
+        return EXIT_FAILURE;
+
+    switch (eOutType)
+    {
+        case ES_OUTPUT_VIDEO: pOutput = pTsDemuxer->pVideoOutput; break;
+        case ES_OUTPUT_AUDIO: pOutput = pTsDemuxer->pAudioOutput; break;
+        default:              return EXIT_FAILURE;
+    }
+
+    pTsDemuxer->pFlush     [eOutType] = eFlush;
+    pTsDemuxer->pFlushValue[eOutType] = uValue;
+
+    // Output added before gets the policy too
+    if ((pOutput != BAD_ES_OUTPUT) && (es_output_set_flush(pOutput, eFlush, uValue) != EXIT_SUCCESS))
+        return EXIT_FAILURE;
+
+    return EXIT_SUCCESS;
+}
+
+int ts_demuxer_add_ts_output(P_TS_DEMUXER pDemuxer, const char* pFileName, const unsigned int* pPIDs, unsigned int uPIDsNum, unsigned int uRewritePSI)
+{
+    TS_DEMUXER* pTsDemuxer = (TS_DEMUXER*) pDemuxer;
+    unsigned int i;
+
+    if (! pTsDemuxer)
+        return EXIT_FAILURE;
+
+    if (pTsDemuxer->pTsOutput != BAD_TS_OUTPUT)
+    {
+        ERR("TS output already exists\n");
+        return EXIT_FAILURE;
+    }
+
+    pTsDemuxer->pTsOutput = ts_output_create(pFileName, pTsDemuxer->uPacketSize, uRewritePSI);
+
+    if (pTsDemuxer->pTsOutput == BAD_TS_OUTPUT)
+        return EXIT_FAILURE;
+
+    for (i = 0; i < uPIDsNum; i ++)
+    {
+        if (ts_output_keep_pid(pTsDemuxer->pTsOutput, pPIDs[i]) != EXIT_SUCCESS)
+        {
+            ERR("Incorrect PID %u\n", pPIDs[i]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
+
+int ts_demuxer_start(P_TS_DEMUXER pDemuxer)
+{
+    TS_DEMUXER* pTsDemuxer = (TS_DEMUXER*) pDemuxer;
+    int         nResult    = EXIT_SUCCESS;
+
+    if (! pTsDemuxer)
+        return EXIT_FAILURE;
+
+    // Elementary streams are not parsed at all if there is TS output only
+    unsigned int uParseES = (pTsDemuxer->pVideoOutput != BAD_ES_OUTPUT)
+                         || (pTsDemuxer->pAudioOutput != BAD_ES_OUTPUT)
+                         || (pTsDemuxer->pTsOutput    == BAD_TS_OUTPUT);
+
+    // Memory allocation for data buffer
+    unsigned int   uBufSize = pTsDemuxer->uPacketSize * 1024;
+    unsigned char* pBuffer  = (unsigned char*) malloc(uBufSize);
+
+    if (! pBuffer)
+        return EXIT_FAILURE;
+
+    // Growth of the input is watched from the very beginning, so no append is missed
+    int nNotifyFd = -1;
+
+    if (pTsDemuxer->uFollowTimeout > 0)
+    {
+        nNotifyFd = inotify_init1(IN_CLOEXEC);
+
+        if ((nNotifyFd < 0)
+        ||  (inotify_add_watch(nNotifyFd, pTsDemuxer->pFileName, IN_MODIFY | IN_CLOSE_WRITE | IN_DELETE_SELF | IN_MOVE_SELF) < 0))
+        {
+            ERR("Cannot watch input file \"%s\"\n", pTsDemuxer->pFileName);
+
+            if (nNotifyFd >= 0)
+                close(nNotifyFd);
+
+            free(pBuffer);
+            return EXIT_FAILURE;
+        }
+    }
+
+    // Read data to buffer and process it.
+    // Incomplete packet at the end of buffer is moved to its beginning and completed by the next read.
+    unsigned int uKept = 0;
+
+    OUT("----------------------------------------\n");
+
+    for ( ; ; )
+    {
+        unsigned int uRead  = fread(pBuffer + uKept, 1, uBufSize - uKept, pTsDemuxer->pFile);
+        unsigned int uAvail = uKept + uRead;
+        unsigned int uFull  = (uRead == (uBufSize - uKept));
+
+        pTsDemuxer->lluBufferEnd += uRead;
+
+        if ((pTsDemuxer->pTsOutput != BAD_TS_OUTPUT) && (ts_output_parse_packets(pTsDemuxer->pTsOutput, pBuffer, uAvail) != EXIT_SUCCESS))
+        {
+            nResult = EXIT_FAILURE;
+            break;
+        }
+
+        if (! uParseES)
+        {
+            pTsDemuxer->uPacketsNum += uAvail / pTsDemuxer->uPacketSize;
+            pTsDemuxer->lluFileOffset += uAvail - (uAvail % pTsDemuxer->uPacketSize);
+        }
+        else if (_ts_demuxer_parse_packet(pTsDemuxer, pBuffer, uAvail) != EXIT_SUCCESS)
+        {
+            nResult = EXIT_FAILURE;
+            break;
+        }
+
+        uKept = uAvail % pTsDemuxer->uPacketSize;
+
+        if (uKept > 0)
+            memmove(pBuffer, pBuffer + (uAvail - uKept), uKept);
+
+        if (! uFull)
+        {
+            // End of file: buffered ES data must not wait for the next input
+            ts_demuxer_poll(pDemuxer, 1, NULL);
+
+            // Wait until the input grows or idle timeout expires
+            if ((nNotifyFd >= 0) && (_ts_demuxer_wait_growth(pTsDemuxer, nNotifyFd) == EXIT_SUCCESS))
+            {
+                clearerr(pTsDemuxer->pFile);
+                continue;
+            }
+
+            // The whole input is processed, checkpoint is not needed anymore
+            if (pTsDemuxer->pCheckpointName)
+                remove(pTsDemuxer->pCheckpointName);
+
+            break;
+        }
+    }
+
+    if (nNotifyFd >= 0)
+        close(nNotifyFd);
+
+    // Release data buffer
+    free(pBuffer);
+
+    OUT("----------------------------------------\n");
+    OUT("%u packets were processed\n", pTsDemuxer->uPacketsNum);
+    return nResult;
+}
+
+int ts_demuxer_scan(P_TS_DEMUXER pDemuxer)
+{
+    TS_DEMUXER* pTsDemuxer = (TS_DEMUXER*) pDemuxer;
+    int         nResult    = EXIT_SUCCESS;
+
+    if (! pTsDemuxer)
+        return EXIT_FAILURE;
+
+    // Memory allocation for per-PID statistics
+    if (! pTsDemuxer->pPidInfo)
+        pTsDemuxer->pPidInfo = (TS_PID_INFO*) calloc(TS_PID_NUM, sizeof(TS_PID_INFO));
+
+    if (! pTsDemuxer->pPidInfo)
+        return EXIT_FAILURE;
+
+    pTsDemuxer->eMode  = TS_MODE_SCAN;
+    pTsDemuxer->uQuiet = 1;
+
+    // Memory allocation for data buffer
+    unsigned int   uBufSize = pTsDemuxer->uPacketSize * TS_BULK_BUF_PACKETS;
+    unsigned char* pBuffer  = (unsigned char*) malloc(uBufSize);
+
+    if (! pBuffer)
+        return EXIT_FAILURE;
+
+    // Reading is purely sequential and payload is never copied
+    posix_fadvise(fileno(pTsDemuxer->pFile), 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    // Read data to buffer and process it
+    for ( ; ; )
+    {
+        unsigned int uRead = fread(pBuffer, 1, uBufSize, pTsDemuxer->pFile);
+
+        if (_ts_demuxer_scan_packet(pTsDemuxer, pBuffer, uRead) != EXIT_SUCCESS)
+        {
+            nResult = EXIT_FAILURE;
+            break;
+        }
+
+        if (uRead != uBufSize)
+            break;
+    }
+
+    // Release data buffer
+    free(pBuffer);
+
+    OUT("----------------------------------------\n");
+    _ts_demuxer_scan_report(pTsDemuxer);
+    OUT("%u packets were scanned\n", pTsDemuxer->uPacketsNum);
+    return nResult;
+}
+
+int ts_demuxer_segment(P_TS_DEMUXER pDemuxer, const char* pPrefix, unsigned int uDuration)
+{
+    TS_DEMUXER*  pTsDemuxer = (TS_DEMUXER*) pDemuxer;
+    TS_SEGMENTER tSegmenter;
+    int          nResult    = EXIT_SUCCESS;
+
+    if ((! pTsDemuxer) || (! pPrefix) || (! uDuration))
+        return EXIT_FAILURE;
+
+    pTsDemuxer->eMode = TS_MODE_SEGMENT;
+
+    memset(&tSegmenter, 0, sizeof(tSegmenter));
+    tSegmenter.pPrefix   = pPrefix;
+    tSegmenter.lluTarget = (unsigned long long) uDuration * 90000;
+
+    // Memory allocation for data buffer and copies of PAT and PMT packets
+    unsigned int   uBufSize = pTsDemuxer->uPacketSize * TS_BULK_BUF_PACKETS;
+    unsigned char* pBuffer  = (unsigned char*) malloc(uBufSize + pTsDemuxer->uPacketSize * 2);
+
+    if (! pBuffer)
+        return EXIT_FAILURE;
+
+    tSegmenter.pPatPacket = pBuffer + uBufSize;
+    tSegmenter.pPmtPacket = pBuffer + uBufSize + pTsDemuxer->uPacketSize;
+    tSegmenter.pPatPacket[0] = 0;
+    tSegmenter.pPmtPacket[0] = 0;
+
+    posix_fadvise(fileno(pTsDemuxer->pFile), 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    // Read data to buffer and split it
+    OUT("Segment duration  : %u seconds\n", uDuration);
+    OUT("----------------------------------------\n");
+
+    if (_ts_demuxer_segment_open(pTsDemuxer, &tSegmenter) != EXIT_SUCCESS)
+        nResult = EXIT_FAILURE;
+
+    for ( ; (nResult == EXIT_SUCCESS) ; )
+    {
+        unsigned int uRead = fread(pBuffer, 1, uBufSize, pTsDemuxer->pFile);
+
+        if (_ts_demuxer_segment_packet(pTsDemuxer, &tSegmenter, pBuffer, uRead) != EXIT_SUCCESS)
+            nResult = EXIT_FAILURE;
+
+        if (uRead != uBufSize)
+            break;
+    }
+
+    if (_ts_demuxer_segment_close(&tSegmenter, tSegmenter.lluLastPTS) != EXIT_SUCCESS)
+        nResult = EXIT_FAILURE;
+
+    if (! pTsDemuxer->uVideoPID)
+        ERR("Video stream was not found, input was not split\n");
+
+    if ((nResult == EXIT_SUCCESS) && (_ts_demuxer_segment_playlist(&tSegmenter) != EXIT_SUCCESS))
+        nResult = EXIT_FAILURE;
+
+    // Release buffers
+    free(tSegmenter.pDurations);
+    free(pBuffer);
+
+    OUT("----------------------------------------\n");
+    OUT("%u packets were split into %u segments\n", pTsDemuxer->uPacketsNum, tSegmenter.uIndex);
+    return nResult;
+}
+
+int ts_demuxer_playout(P_TS_DEMUXER pDemuxer, const char* pTarget)
+{
+    TS_DEMUXER*  pTsDemuxer = (TS_DEMUXER*) pDemuxer;
+    int          nResult    = EXIT_SUCCESS;
+    unsigned int uPacketSize;
+
+    if ((! pTsDemuxer) || (! pTarget))
+        return EXIT_FAILURE;
+
+    uPacketSize = pTsDemuxer->uPacketSize;
+
+    // Memory allocation for per-PID information, PAT and PMT are parsed to find PCR PID
+    if (! pTsDemuxer->pPidInfo)
+        pTsDemuxer->pPidInfo = (TS_PID_INFO*) calloc(TS_PID_NUM, sizeof(TS_PID_INFO));
+
+    if (! pTsDemuxer->pPidInfo)
+        return EXIT_FAILURE;
+
+    pTsDemuxer->eMode  = TS_MODE_PLAYOUT;
+    pTsDemuxer->uQuiet = 1;
+
+    P_TS_PLAYOUT pPlayout = ts_playout_create(pTarget, uPacketSize);
+
+    if (pPlayout == BAD_TS_PLAYOUT)
+        return EXIT_FAILURE;
+
+    // Memory allocation for data buffer
+    unsigned int   uBufSize = uPacketSize * TS_BULK_BUF_PACKETS;
+    unsigned char* pBuffer  = (unsigned char*) malloc(uBufSize);
+
+    if (! pBuffer)
+    {
+        ts_playout_free(pPlayout);
+        return EXIT_FAILURE;
+    }
+
+    // Packets between two PCRs are spread evenly over the time between them.
+    // Packets after the last PCR stay at the beginning of the buffer until the next PCR is read.
+    unsigned long long lluPCR     = 0;  // Last PCR (90 kHz)
+    unsigned long long lluTime    = 0;  // Sending time of the next packet (ns)
+    unsigned long long lluPCRTime = 0;  // Sending time of the last PCR packet (ns)
+    unsigned long long lluStep    = 0;  // Time between packets at the last known rate (ns)
+    unsigned int       uHasPCR    = 0;
+    unsigned int       uKept      = 0;  // Bytes kept in the buffer
+    unsigned int       uScanned   = 0;  // Packets kept in the buffer which are already parsed
+
+    for ( ; (nResult == EXIT_SUCCESS) ; )
+    {
+        unsigned int uRead       = fread(pBuffer + uKept, 1, uBufSize - uKept, pTsDemuxer->pFile);
+        unsigned int uAvail      = uKept + uRead;
+        unsigned int uFull       = (uAvail == uBufSize);
+        unsigned int uPacketsNum = uAvail / uPacketSize;
+        unsigned int uStart      = 0;
+        unsigned int i;
+
+        for (i = uScanned; (nResult == EXIT_SUCCESS) && (i < uPacketsNum); i ++)
+        {
+            unsigned char*     pPacket   = pBuffer + i * uPacketSize;
+            unsigned long long lluNewPCR = 0;
+
+            if (_ts_demuxer_scan_packet(pTsDemuxer, pPacket, uPacketSize) != EXIT_SUCCESS)
+            {
+                nResult = EXIT_FAILURE;
+                break;
+            }
+
+            if (_ts_demuxer_packet_pcr(pTsDemuxer, pPacket, &lluNewPCR) != EXIT_SUCCESS)
+                continue;
+
+            if ((uHasPCR) && (i > uStart))
+            {
+                unsigned long long lluDelta  = _ts_demuxer_pcr_distance(lluPCR, lluNewPCR);
+                unsigned long long lluTarget = lluPCRTime + lluDelta * 100000 / 9;
+
+                // PCR discontinuity: the last known rate is kept
+                if (lluDelta > PLAYOUT_PCR_GAP_MAX)
+                    lluTarget = lluTime + (i - uStart) * lluStep;
+
+                if (lluTarget < lluTime)
+                    lluTarget = lluTime;
+
+                lluStep = (lluTarget - lluTime) / (i - uStart);
+
+                if (ts_playout_send(pPlayout, pBuffer + uStart * uPacketSize, i - uStart, lluTime, lluStep) != EXIT_SUCCESS)
+                    nResult = EXIT_FAILURE;
+
+                lluTime = lluTarget;
+            }
+            else if (i > uStart)
+            {
+                // Packets before the first PCR are sent right away
+                if (ts_playout_send(pPlayout, pBuffer + uStart * uPacketSize, i - uStart, lluTime, 0) != EXIT_SUCCESS)
+                    nResult = EXIT_FAILURE;
+            }
+
+            lluPCRTime = lluTime;
+            lluPCR     = lluNewPCR;
+            uHasPCR    = 1;
+            uStart     = i;
+        }
+
+        // End of file or no PCR in the whole buffer: packets are sent at the last known rate
+        if ((nResult == EXIT_SUCCESS) && ((! uFull) || (! uStart)))
+        {
+            if (ts_playout_send(pPlayout, pBuffer + uStart * uPacketSize, uPacketsNum - uStart, lluTime, lluStep) != EXIT_SUCCESS)
+                nResult = EXIT_FAILURE;
+
+            lluTime += (uPacketsNum - uStart) * lluStep;
+            uStart   = uPacketsNum;
+        }
+
+        if (! uFull)
+            break;
+
+        uKept    = uAvail - uStart * uPacketSize;
+        uScanned = uPacketsNum - uStart;
+
+        if (uKept > 0)
+            memmove(pBuffer, pBuffer + uStart * uPacketSize, uKept);
+    }
+
+    if ((nResult == EXIT_SUCCESS) && (ts_playout_flush(pPlayout) != EXIT_SUCCESS))
+        nResult = EXIT_FAILURE;
+
+    if (! uHasPCR)
+        ERR("PCR was not found, input was sent without pacing\n");
+
+    // Release data buffer
+    free(pBuffer);
+
+    OUT("----------------------------------------\n");
+    ts_playout_free(pPlayout);
+    OUT("%u packets were played out\n", pTsDemuxer->uPacketsNum);
+    return nResult;
+}
+
+int ts_demuxer_set_checkpoint(P_TS_DEMUXER pDemuxer, const char* pFileName, unsigned int uStep)
+{
+    TS_DEMUXER* pTsDemuxer = (TS_DEMUXER*) pDemuxer;
+
+    if ((! pTsDemuxer) || (! pFileName) || (! uStep))
+        return EXIT_FAILURE;
+
+    OUT("Checkpoint file   : \"%s\" (every %u bytes)\n", pFileName, uStep);
+
+    pTsDemuxer->pCheckpointName   = pFileName;
+    pTsDemuxer->lluCheckpointStep = uStep;
+
+    return EXIT_SUCCESS;
+}
+
+int ts_demuxer_set_follow(P_TS_DEMUXER pDemuxer, unsigned int uTimeout)
+{
+    TS_DEMUXER* pTsDemuxer = (TS_DEMUXER*) pDemuxer;
+
+    if ((! pTsDemuxer) || (uTimeout > INT_MAX))
+        return EXIT_FAILURE;
+
+    OUT("Follow input      : %u ms idle timeout\n", uTimeout);
+
+    pTsDemuxer->uFollowTimeout = uTimeout;
+
+    return EXIT_SUCCESS;
+}
+
+int ts_demuxer_resume(P_TS_DEMUXER pDemuxer)
+{
+    TS_DEMUXER* pTsDemuxer = (TS_DEMUXER*) pDemuxer;
+
+    P_ES_OUTPUT  pOutputs[ES_OUTPUT_MAX_NUM] = { BAD_ES_OUTPUT, BAD_ES_OUTPUT };
+    unsigned int uVersion    = 0;
+    unsigned int uPacketSize = 0;
+    unsigned int uPacketsNum = 0;
+    unsigned int uHash       = 0;
+    unsigned int uPIDs[4]    = { 0, 0, 0, 0 };
+    unsigned int uOutputsNum = 0;
+    unsigned int i;
+
+    unsigned long long lluOffset = 0;
+
+    if ((! pTsDemuxer) || (! pTsDemuxer->pCheckpointName))
+        return EXIT_FAILURE;
+
+    if (pTsDemuxer->pTsOutput != BAD_TS_OUTPUT)
+    {
+        ERR("TS output cannot be resumed\n");
+        return EXIT_FAILURE;
+    }
+
+    pOutputs[ES_OUTPUT_VIDEO] = pTsDemuxer->pVideoOutput;
+    pOutputs[ES_OUTPUT_AUDIO] = pTsDemuxer->pAudioOutput;
+
+    FILE* pFile = fopen(pTsDemuxer->pCheckpointName, "r");
+
+    if (! pFile)
+    {
+        ERR("Cannot open checkpoint file \"%s\"\n", pTsDemuxer->pCheckpointName);
+        return EXIT_FAILURE;
+    }
+
+    if ((fscanf(pFile, "TS_DEMUXER_CHECKPOINT %u\n", &uVersion) != 1)
+    ||  (uVersion != CHECKPOINT_VERSION)
+    ||  (fscanf(pFile, "input %u %llu %u %X\n", &uPacketSize, &lluOffset, &uPacketsNum, &uHash) != 4)
+    ||  (fscanf(pFile, "pids %u %u %u %u\n", &uPIDs[0], &uPIDs[1], &uPIDs[2], &uPIDs[3]) != 4))
+    {
+        ERR("Incorrect checkpoint file \"%s\"\n", pTsDemuxer->pCheckpointName);
+        fclose(pFile);
+        return EXIT_FAILURE;
+    }
+
+    // Input must be the same stream: packet size and the packet at saved offset are compared
+    if (uPacketSize != pTsDemuxer->uPacketSize)
+    {
+        ERR("Checkpoint does not match input (packet size %u)\n", uPacketSize);
+        fclose(pFile);
+        return EXIT_FAILURE;
+    }
+
+    unsigned char* pPacket = (unsigned char*) malloc(uPacketSize);
+
+    if ((! pPacket)
+    ||  (fseeko(pTsDemuxer->pFile, (off_t) lluOffset, SEEK_SET) < 0)
+    ||  (fread(pPacket, 1, uPacketSize, pTsDemuxer->pFile) != uPacketSize)
+    ||  (_ts_demuxer_checkpoint_hash(pPacket, uPacketSize) != uHash))
+    {
+        ERR("Checkpoint does not match input (offset %llu)\n", lluOffset);
+        free(pPacket);
+        fclose(pFile);
+        return EXIT_FAILURE;
+    }
+
+    free(pPacket);
+
+    // Outputs are cut to the saved length
+    for ( ; ; )
+    {
+        unsigned int       uType       = 0;
+        unsigned int       uOutPackets = 0;
+        unsigned int       uContinuity = 0;
+        unsigned long long lluLength   = 0;
+
+        if (fscanf(pFile, "output %u %u %u %llu\n", &uType, &uOutPackets, &uContinuity, &lluLength) != 4)
+            break;
+
+        if ((uType >= ES_OUTPUT_MAX_NUM) || (pOutputs[uType] == BAD_ES_OUTPUT))
+        {
+            ERR("Checkpoint does not match outputs\n");
+            fclose(pFile);
+            return EXIT_FAILURE;
+        }
+
+        if (es_output_set_state(pOutputs[uType], uOutPackets, uContinuity, lluLength) != EXIT_SUCCESS)
+        {
+            fclose(pFile);
+            return EXIT_FAILURE;
+        }
+
+        pOutputs[uType] = BAD_ES_OUTPUT;
+        uOutputsNum    += 1;
+    }
+
+    fclose(pFile);
+
+    for (i = 0; i < ES_OUTPUT_MAX_NUM; i ++)
+    {
+        if (pOutputs[i] != BAD_ES_OUTPUT)
+        {
+            ERR("Checkpoint does not include %s output\n", es_output_type_str((ES_OUTPUT_TYPE) i));
+            return EXIT_FAILURE;
+        }
+    }
+
+    // Continue from saved position
+    if (fseeko(pTsDemuxer->pFile, (off_t) lluOffset, SEEK_SET) < 0)
+        return EXIT_FAILURE;
+
+    pTsDemuxer->lluFileOffset     = lluOffset;
+    pTsDemuxer->uPacketsNum       = uPacketsNum;
+    pTsDemuxer->uPMT_PID          = uPIDs[0];
+    pTsDemuxer->uPCR_PID          = uPIDs[1];
+    pTsDemuxer->uVideoPID         = uPIDs[2];
+    pTsDemuxer->uAudioPID         = uPIDs[3];
+    pTsDemuxer->lluCheckpointLast = lluOffset;
+    pTsDemuxer->lluBufferEnd      = lluOffset;
+
+    OUT("Resumed at offset : %llu bytes (%u packets, %u outputs)\n", lluOffset, uPacketsNum, uOutputsNum);
+    return EXIT_SUCCESS;
+}
+
+int ts_demuxer_parse_data(P_TS_DEMUXER pDemuxer, unsigned char* pData, unsigned int uLength, unsigned int* pRest)
+{
+    TS_DEMUXER* pTsDemuxer = (TS_DEMUXER*) pDemuxer;
+
+    if ((! pTsDemuxer) || (pTsDemuxer->eMode != TS_MODE_LIVE))
+        return EXIT_FAILURE;
+
+    for ( ; (uLength >= pTsDemuxer->uPacketSize) ; )
+    {
+        // Lost synchronization: skip bytes up to the next sync byte
+        if (pData[0] != TS_SYNC_CODE)
+        {
+            unsigned char* pSync = (unsigned char*) memchr(pData + 1, TS_SYNC_CODE, uLength - 1);
+            unsigned int   uSkip = pSync ? (unsigned int) (pSync - pData) : uLength;
+
+            DBG("%s : %u bytes skipped\n", pTsDemuxer->pFileName, uSkip);
+
+            pTsDemuxer->uErrorsNum += 1;
+            pTsDemuxer->lluFileOffset += uSkip;
+
+            uLength -= uSkip;
+            pData   += uSkip;
+            continue;
+        }
+
+        // Broken packet does not stop live stream processing
+        if (_ts_demuxer_parse_packet(pTsDemuxer, pData, pTsDemuxer->uPacketSize) != EXIT_SUCCESS)
+        {
+            pTsDemuxer->uErrorsNum  += 1;
+            pTsDemuxer->uPacketsNum += 1;
+            pTsDemuxer->lluFileOffset += pTsDemuxer->uPacketSize;
+        }
+
+        uLength -= pTsDemuxer->uPacketSize;
+        pData   += pTsDemuxer->uPacketSize;
+    }
+
+    if (pRest) *pRest = uLength;
+
+    return EXIT_SUCCESS;
+}
+
+int ts_demuxer_get_stats(P_TS_DEMUXER pDemuxer, unsigned int* pPacketsNum, unsigned int* pErrorsNum)
+{
+    TS_DEMUXER* pTsDemuxer = (TS_DEMUXER*) pDemuxer;
+
+    if (! pTsDemuxer)
+        return EXIT_FAILURE;
+
+    // Continuity errors are counted by outputs
+    unsigned int uVideoErrors = 0;
+    unsigned int uAudioErrors = 0;
+
+    es_output_get_errors(pTsDemuxer->pVideoOutput, &uVideoErrors);
+    es_output_get_errors(pTsDemuxer->pAudioOutput, &uAudioErrors);
+
+    if (pPacketsNum) *pPacketsNum = pTsDemuxer->uPacketsNum;
+    if (pErrorsNum)  *pErrorsNum  = pTsDemuxer->uErrorsNum + uVideoErrors + uAudioErrors;
+
+    return EXIT_SUCCESS;
+}
+
+int ts_demuxer_poll(P_TS_DEMUXER pDemuxer, unsigned int uIdle, unsigned int* pTimeout)
+{
+    TS_DEMUXER*  pTsDemuxer    = (TS_DEMUXER*) pDemuxer;
+    unsigned int uVideoTimeout = UINT_MAX;
+    unsigned int uAudioTimeout = UINT_MAX;
+
+    if (! pTsDemuxer)
+        return EXIT_FAILURE;
+
+    if ((pTsDemuxer->pVideoOutput != BAD_ES_OUTPUT) && (es_output_poll(pTsDemuxer->pVideoOutput, uIdle, &uVideoTimeout) != EXIT_SUCCESS))
+        return EXIT_FAILURE;
+
+    if ((pTsDemuxer->pAudioOutput != BAD_ES_OUTPUT) && (es_output_poll(pTsDemuxer->pAudioOutput, uIdle, &uAudioTimeout) != EXIT_SUCCESS))
+        return EXIT_FAILURE;
+
+    // The nearest flush deadline
+    if (pTimeout) *pTimeout = (uVideoTimeout < uAudioTimeout) ? uVideoTimeout : uAudioTimeout;
+
+    return EXIT_SUCCESS;
+}
+
+int ts_demuxer_get_latency(P_TS_DEMUXER   pDemuxer,
+                           ES_OUTPUT_TYPE eOutType,
+                           unsigned int*  pP50,
+                           unsigned int*  pP90,
+                           unsigned int*  pP99,
+                           unsigned int*  pMax)
+{
+    TS_DEMUXER* pTsDemuxer = (TS_DEMUXER*) pDemuxer;
+
+    if (! pTsDemuxer)
+        return EXIT_FAILURE;
+
+    switch (eOutType)
+    {
+        case ES_OUTPUT_VIDEO: return es_output_get_latency(pTsDemuxer->pVideoOutput, pP50, pP90, pP99, pMax);
+        case ES_OUTPUT_AUDIO: return es_output_get_latency(pTsDemuxer->pAudioOutput, pP50, pP90, pP99, pMax);
+        default:              break;
+    }
+
+    return EXIT_FAILURE;
+}
+
+int ts_demuxer_probe(const char* pFileName, const char* pCacheName, unsigned int uBudget, unsigned int uTimeLimit, TS_PROBE_INFO* pInfo)
+{
+    TS_PROBE_INFO tInfo;
+    struct stat   tStat;
+    char          pPath[PATH_MAX];
+
+    if (! pFileName)
+        return EXIT_FAILURE;
+
+    if (stat(pFileName, &tStat) < 0)
+    {
+        ERR("Cannot get information about \"%s\"\n", pFileName);
+        return EXIT_FAILURE;
+    }
+
+    memset(&tInfo, 0, sizeof(tInfo));
+
+    // Cache is keyed by the real path, so different names of one file share the entry
+    if (! realpath(pFileName, pPath))
+        snprintf(pPath, sizeof(pPath), "%s", pFileName);
+
+    // Cached result is valid while the file keeps its size and modification time
+    if ((pCacheName) && (_ts_demuxer_probe_cache_load(pCacheName, pPath, &tStat, &tInfo) == EXIT_SUCCESS))
+    {
+        OUT("Input TS file     : \"%s\" (cached)\n", pFileName);
+    }
+    else
+    {
+        P_TS_DEMUXER pDemuxer = ts_demuxer_create(pFileName);
+
+        if (pDemuxer == BAD_TS_DEMUXER)
+            return EXIT_FAILURE;
+
+        memset(&tInfo, 0, sizeof(tInfo));
+
+        int nResult = _ts_demuxer_probe_file((TS_DEMUXER*) pDemuxer, uBudget, uTimeLimit, &tInfo);
+
+        ts_demuxer_free(pDemuxer);
+
+        if (nResult != EXIT_SUCCESS)
+            return EXIT_FAILURE;
+
+        // Cache is an optimization only, failure to update it is not fatal.
+        // Result cut by the budget may be completed by the next probe, so it is not cached.
+        if ((pCacheName) && (tInfo.uComplete))
+            _ts_demuxer_probe_cache_save(pCacheName, pPath, &tStat, &tInfo);
+    }
+
+    _ts_demuxer_probe_report(&tInfo);
+
+    if (pInfo) *pInfo = tInfo;
 
-    OUT("----------------------------------------\n");
-    OUT("%u packets were processed\n", pTsDemuxer->uPacketsNum);
     return EXIT_SUCCESS;
 }
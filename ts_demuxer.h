@@ -2,15 +2,71 @@
 #define __TS_DEMUXER_H__
 
 #include "es_output.h"
+#include "ts_output.h"
 
 typedef void* P_TS_DEMUXER;
 
 #define BAD_TS_DEMUXER ((P_TS_DEMUXER) NULL)
 
-P_TS_DEMUXER ts_demuxer_create     (const char* pFileName);
-void         ts_demuxer_free       (P_TS_DEMUXER pDemuxer);
+#define TS_PROBE_STREAMS_MAX 32
 
-int          ts_demuxer_add_output (P_TS_DEMUXER pDemuxer, ES_OUTPUT_TYPE eOutType, const char* pFileName);
-int          ts_demuxer_start      (P_TS_DEMUXER pDemuxer);
+typedef struct _TS_PROBE_STREAM {
+    unsigned int       uPID;
+    unsigned int       uStreamType;
+    unsigned int       uHasPTS;
+    unsigned long long lluFirstPTS;      // 90 kHz
+} TS_PROBE_STREAM;
+
+typedef struct _TS_PROBE_INFO {
+    unsigned int       uPacketSize;
+    unsigned int       uComplete;        // PAT, all PMTs, PCR and first PTS of all streams are found
+    unsigned int       uBytesRead;
+    unsigned int       uPCR_PID;
+    unsigned long long lluDuration;      // 90 kHz, estimated from the first and the last PCR
+    unsigned int       uStreamsNum;
+    TS_PROBE_STREAM    pStreams[TS_PROBE_STREAMS_MAX];
+} TS_PROBE_INFO;
+
+P_TS_DEMUXER ts_demuxer_create         (const char* pFileName);
+P_TS_DEMUXER ts_demuxer_create_live    (const char* pName);
+void         ts_demuxer_free           (P_TS_DEMUXER pDemuxer);
+
+int          ts_demuxer_add_output     (P_TS_DEMUXER pDemuxer, ES_OUTPUT_TYPE eOutType, const char* pFileName);
+int          ts_demuxer_add_ts_output  (P_TS_DEMUXER        pDemuxer,
+                                        const char*         pFileName,
+                                        const unsigned int* pPIDs,
+                                        unsigned int        uPIDsNum,
+                                        unsigned int        uRewritePSI);
+int          ts_demuxer_set_checkpoint (P_TS_DEMUXER pDemuxer, const char* pFileName, unsigned int uStep);
+int          ts_demuxer_set_follow     (P_TS_DEMUXER pDemuxer, unsigned int uTimeout);
+int          ts_demuxer_set_reassembly (P_TS_DEMUXER pDemuxer, unsigned int uPoolLimit);
+int          ts_demuxer_set_flush      (P_TS_DEMUXER    pDemuxer,
+                                        ES_OUTPUT_TYPE  eOutType,
+                                        ES_FLUSH_POLICY eFlush,
+                                        unsigned int    uValue);
+int          ts_demuxer_resume         (P_TS_DEMUXER pDemuxer);
+int          ts_demuxer_start          (P_TS_DEMUXER pDemuxer);
+int          ts_demuxer_scan           (P_TS_DEMUXER pDemuxer);
+int          ts_demuxer_segment        (P_TS_DEMUXER pDemuxer, const char* pPrefix, unsigned int uDuration);
+int          ts_demuxer_playout        (P_TS_DEMUXER pDemuxer, const char* pTarget);
+
+int          ts_demuxer_parse_data     (P_TS_DEMUXER   pDemuxer,
+                                        unsigned char* pData,
+                                        unsigned int   uLength,
+                                        unsigned int*  pRest);
+int          ts_demuxer_get_stats      (P_TS_DEMUXER pDemuxer, unsigned int* pPacketsNum, unsigned int* pErrorsNum);
+int          ts_demuxer_poll           (P_TS_DEMUXER pDemuxer, unsigned int uIdle, unsigned int* pTimeout);
+int          ts_demuxer_get_latency    (P_TS_DEMUXER   pDemuxer,
+                                        ES_OUTPUT_TYPE eOutType,
+                                        unsigned int*  pP50,
+                                        unsigned int*  pP90,
+                                        unsigned int*  pP99,
+                                        unsigned int*  pMax);
+
+int          ts_demuxer_probe          (const char*    pFileName,
+                                        const char*    pCacheName,
+                                        unsigned int   uBudget,
+                                        unsigned int   uTimeLimit,
+                                        TS_PROBE_INFO* pInfo);
 
 #endif // __TS_DEMUXER_H__
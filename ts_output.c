@@ -0,0 +1,409 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "print_out.h"
+#include "ts_output.h"
+
+#define TS_PACKET_SIZE      188
+
+#define TS_SYNC_CODE        0x47
+
+#define TS_PAYLOAD_ONLY     0x01
+#define TS_ADAPT_FIELD_ONLY 0x02
+
+#define TS_AF_PCR           0x10
+
+#define TS_PID_PAT          0x0000
+#define TS_PID_NULL         0x1FFF
+#define TS_PID_NUM          0x2000
+
+#define TABLE_ID_PAT        0x00
+#define TABLE_ID_PMT        0x02
+
+#define TS_OUTPUT_BUF_SIZE  (1024 * 1024)
+
+#define PID_BIT_SET(pMap, uPID) ((pMap)[(uPID) >> 3] |=  (1 << ((uPID) & 0x07)))
+#define PID_BIT_CLR(pMap, uPID) ((pMap)[(uPID) >> 3] &= ~(1 << ((uPID) & 0x07)))
+#define PID_BIT_GET(pMap, uPID) ((pMap)[(uPID) >> 3] &   (1 << ((uPID) & 0x07)))
+
+typedef struct _TS_OUTPUT {
+    const char*    pFileName;
+    FILE*          pFile;
+    unsigned int   uPacketSize;
+    unsigned int   uRewritePSI;
+    unsigned int   uPacketsNum;
+    unsigned int   uDroppedNum;
+    unsigned char  pKeepMap [TS_PID_NUM / 8];
+    unsigned char  pPmtMap  [TS_PID_NUM / 8];
+    unsigned char  pEmptyMap[TS_PID_NUM / 8]; // PMTs without kept streams
+    unsigned char  pPcrMap  [TS_PID_NUM / 8]; // PCR PIDs which are not kept, only their PCRs are
+    unsigned char  pLongMap [TS_PID_NUM / 8]; // PSI PIDs with sections longer than one packet
+    unsigned char* pPacket;
+} TS_OUTPUT;
+
+static unsigned int puCRC32[256];
+
+static void _ts_output_init_crc32(void)
+{
+    unsigned int i, j;
+
+    if (puCRC32[1])
+        return;
+
+    // CRC-32/MPEG-2: polynomial 0x04C11DB7, no reflection
+    for (i = 0; i < 256; i ++)
+    {
+        unsigned int uCRC = i << 24;
+
+        for (j = 0; j < 8; j ++)
+            uCRC = (uCRC & 0x80000000) ? ((uCRC << 1) ^ 0x04C11DB7) : (uCRC << 1);
+
+        puCRC32[i] = uCRC;
+    }
+}
+
+static unsigned int _ts_output_crc32(unsigned char* pData, unsigned int uLength)
+{
+    unsigned int uCRC = 0xFFFFFFFF;
+
+    for ( ; (uLength > 0) ; uLength --)
+        uCRC = (uCRC << 8) ^ puCRC32[((uCRC >> 24) ^ *pData++) & 0xFF];
+
+    return uCRC;
+}
+
+static int _ts_output_write(TS_OUTPUT* pTsOutput, unsigned char* pData, unsigned int uLength)
+{
+    if ((uLength > 0) && (fwrite(pData, 1, uLength, pTsOutput->pFile) != uLength))
+    {
+        ERR("Cannot write TS output file \"%s\"\n", pTsOutput->pFileName);
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+// Rebuild single-packet PAT or PMT section without references to dropped PIDs.
+// Programs are kept by their PMTs, the program is dropped when its PMT has no kept streams.
+// Returns the length of new section (without CRC32) or 0 if the section is kept unchanged.
+static unsigned int _ts_output_rewrite_section(TS_OUTPUT*     pTsOutput,
+                                               unsigned int   uPID,
+                                               unsigned char* pSection,
+                                               unsigned int   uSectionLen,
+                                               unsigned char* pNewSection)
+{
+    unsigned char uTableID = pSection[0];
+    unsigned int  uNewLen  = 0;
+    unsigned int  uPos     = 0;
+
+    if (uTableID == TABLE_ID_PAT)
+    {
+        // Table header (8 bytes) is followed by 4-byte program entries
+        memcpy(pNewSection, pSection, 8);
+        uNewLen = 8;
+
+        for (uPos = 8; ((uPos + 4) <= uSectionLen) ; uPos += 4)
+        {
+            unsigned int uProgramNum  =  pSection[uPos    ]         << 8;
+                         uProgramNum |=  pSection[uPos + 1];
+            unsigned int uPMT_PID     = (pSection[uPos + 2] & 0x1F) << 8;
+                         uPMT_PID    |=  pSection[uPos + 3];
+
+            if (uProgramNum > 0)
+            {
+                PID_BIT_SET(pTsOutput->pPmtMap, uPMT_PID);
+
+                if (PID_BIT_GET(pTsOutput->pEmptyMap, uPMT_PID))
+                    continue;
+            }
+            else if (! PID_BIT_GET(pTsOutput->pKeepMap, uPMT_PID))
+            {
+                // Network PID is kept only on request
+                continue;
+            }
+
+            memcpy(pNewSection + uNewLen, pSection + uPos, 4);
+            uNewLen += 4;
+        }
+    }
+    else if (uTableID == TABLE_ID_PMT)
+    {
+        // Table header (12 bytes) and program descriptors are followed by stream entries
+        unsigned int uInfoLen  = (pSection[10] & 0x03) << 8;
+                     uInfoLen |=  pSection[11];
+
+        if ((12 + uInfoLen) > uSectionLen)
+            return 0;
+
+        memcpy(pNewSection, pSection, 12 + uInfoLen);
+        uNewLen = 12 + uInfoLen;
+
+        for (uPos = uNewLen; ((uPos + 5) <= uSectionLen) ; )
+        {
+            unsigned int uStreamPID  = (pSection[uPos + 1] & 0x1F) << 8;
+                         uStreamPID |=  pSection[uPos + 2];
+            unsigned int uStrInfLen  = (pSection[uPos + 3] & 0x03) << 8;
+                         uStrInfLen |=  pSection[uPos + 4];
+
+            if ((uPos + 5 + uStrInfLen) > uSectionLen)
+                break;
+
+            if (PID_BIT_GET(pTsOutput->pKeepMap, uStreamPID))
+            {
+                memcpy(pNewSection + uNewLen, pSection + uPos, 5 + uStrInfLen);
+                uNewLen += (5 + uStrInfLen);
+            }
+
+            uPos += (5 + uStrInfLen);
+        }
+
+        // Timing of the kept program is needed by the players even if PCR PID was not requested
+        unsigned int uPCR_PID  = (pSection[8] & 0x1F) << 8;
+                     uPCR_PID |=  pSection[9];
+
+        if (uNewLen == (12 + uInfoLen))
+        {
+            PID_BIT_SET(pTsOutput->pEmptyMap, uPID);
+        }
+        else
+        {
+            PID_BIT_CLR(pTsOutput->pEmptyMap, uPID);
+
+            if ((uPCR_PID != TS_PID_NULL) && (! PID_BIT_GET(pTsOutput->pKeepMap, uPCR_PID)) && (! PID_BIT_GET(pTsOutput->pPcrMap, uPCR_PID)))
+            {
+                PID_BIT_SET(pTsOutput->pPcrMap, uPCR_PID);
+                OUT("PID %u: PCR PID of kept program, packets with PCR are kept without payload\n", uPCR_PID);
+            }
+        }
+    }
+    else
+    {
+        return 0;
+    }
+
+    // Update section length (including CRC32)
+    pNewSection[1] = (pNewSection[1] & 0xFC) | (((uNewLen + 1) >> 8) & 0x03);
+    pNewSection[2] =  (uNewLen + 1) & 0xFF;
+
+    return uNewLen;
+}
+
+// Returns packet with PCR only (adaptation field without payload) or NULL if the packet has no PCR
+static unsigned char* _ts_output_strip_pcr(TS_OUTPUT* pTsOutput, unsigned char* pPacket)
+{
+    unsigned int   uFieldCtrl = (pPacket[3] & 0x30) >> 4;
+    unsigned int   uAdaptLen  = pPacket[4];
+    unsigned char* pNewPacket = pTsOutput->pPacket;
+
+    if ((! (uFieldCtrl & TS_ADAPT_FIELD_ONLY)) || (uAdaptLen < 7) || ((5 + uAdaptLen) > TS_PACKET_SIZE) || (! (pPacket[5] & TS_AF_PCR)))
+        return NULL;
+
+    // Adaptation field is stretched with stuffing over the whole packet, continuity counter is not incremented for such packets
+    memcpy(pNewPacket, pPacket, 5 + uAdaptLen);
+    memset(pNewPacket + 5 + uAdaptLen, 0xFF, pTsOutput->uPacketSize - (5 + uAdaptLen));
+
+    pNewPacket[1] &= ~0x40;
+    pNewPacket[3]  = (pNewPacket[3] & 0xCF) | (TS_ADAPT_FIELD_ONLY << 4);
+    pNewPacket[4]  = TS_PACKET_SIZE - 5;
+
+    return pNewPacket;
+}
+
+// Returns the rewritten packet or NULL if the packet should be written as is
+static unsigned char* _ts_output_rewrite_psi(TS_OUTPUT* pTsOutput, unsigned char* pPacket)
+{
+    unsigned int uFieldCtrl = (pPacket[3] & 0x30) >> 4;
+    unsigned int uHeaderLen = (uFieldCtrl & TS_ADAPT_FIELD_ONLY) ? (5 + pPacket[4]) : 4;
+
+    if ((! (uFieldCtrl & TS_PAYLOAD_ONLY)) || ((uHeaderLen + 1) >= TS_PACKET_SIZE))
+        return NULL;
+
+    // Pointer field and section header
+    unsigned int uSectionPos = uHeaderLen + 1 + pPacket[uHeaderLen];
+
+    if ((uSectionPos + 3) > TS_PACKET_SIZE)
+        return NULL;
+
+    unsigned char* pSection    = pPacket + uSectionPos;
+    unsigned int   uSectionLen = (pSection[1] & 0x03) << 8;
+                   uSectionLen |=  pSection[2];
+
+    // Only sections which fit into one packet are rewritten, others may refer to dropped PIDs
+    if ((uSectionLen < 9) || ((uSectionPos + 3 + uSectionLen) > TS_PACKET_SIZE))
+    {
+        unsigned int uPID = ((pPacket[1] & 0x1F) << 8) | pPacket[2];
+
+        if (! PID_BIT_GET(pTsOutput->pLongMap, uPID))
+        {
+            PID_BIT_SET(pTsOutput->pLongMap, uPID);
+            OUT("PID %u: PSI section is longer than one packet, it is kept without rewriting\n", uPID);
+        }
+
+        return NULL;
+    }
+
+    // Build new packet: original header, pointer field 0, new section, CRC32 and stuffing
+    unsigned char* pNewPacket  = pTsOutput->pPacket;
+    unsigned char* pNewSection = pNewPacket + uHeaderLen + 1;
+    unsigned int   uNewLen     = 0;
+
+    memcpy(pNewPacket, pPacket, pTsOutput->uPacketSize);
+    pNewPacket[uHeaderLen] = 0;
+
+    // Section without CRC32
+    uNewLen = _ts_output_rewrite_section(pTsOutput, ((pPacket[1] & 0x1F) << 8) | pPacket[2], pSection, 3 + uSectionLen - 4, pNewSection);
+
+    if (! uNewLen)
+        return NULL;
+
+    unsigned int uCRC = _ts_output_crc32(pNewSection, uNewLen);
+
+    pNewSection[uNewLen    ] = (uCRC >> 24) & 0xFF;
+    pNewSection[uNewLen + 1] = (uCRC >> 16) & 0xFF;
+    pNewSection[uNewLen + 2] = (uCRC >>  8) & 0xFF;
+    pNewSection[uNewLen + 3] =  uCRC        & 0xFF;
+
+    memset(pNewSection + uNewLen + 4, 0xFF, TS_PACKET_SIZE - (uHeaderLen + 1 + uNewLen + 4));
+
+    return pNewPacket;
+}
+
+P_TS_OUTPUT ts_output_create(const char* pFileName, unsigned int uPacketSize, unsigned int uRewritePSI)
+{
+    if (uPacketSize < TS_PACKET_SIZE)
+        return BAD_TS_OUTPUT;
+
+    // Memory allocation for description struct and filling it
+    TS_OUTPUT* pTsOutput = (TS_OUTPUT*) calloc(1, sizeof(TS_OUTPUT) + uPacketSize);
+
+    if (! pTsOutput)
+        return BAD_TS_OUTPUT;
+
+    pTsOutput->pFile = fopen(pFileName, "wb");
+
+    if (! pTsOutput->pFile)
+    {
+        ERR("Cannot create TS output file \"%s\"\n", pFileName);
+        free(pTsOutput);
+        return BAD_TS_OUTPUT;
+    }
+
+    // Large stdio buffer: long runs of kept packets bypass it, short ones are gathered
+    setvbuf(pTsOutput->pFile, NULL, _IOFBF, TS_OUTPUT_BUF_SIZE);
+
+    OUT("TS output file    : \"%s\"%s\n", pFileName, uRewritePSI ? " (PAT/PMT rewriting)" : "");
+
+    pTsOutput->pFileName   = pFileName;
+    pTsOutput->uPacketSize = uPacketSize;
+    pTsOutput->uRewritePSI = uRewritePSI;
+    pTsOutput->uPacketsNum = 0;
+    pTsOutput->uDroppedNum = 0;
+    pTsOutput->pPacket     = (unsigned char*) (pTsOutput + 1);
+
+    if (uRewritePSI)
+    {
+        _ts_output_init_crc32();
+        PID_BIT_SET(pTsOutput->pKeepMap, TS_PID_PAT);
+    }
+
+    // Return the pointer to description struct
+    return (P_TS_OUTPUT) pTsOutput;
+}
+
+void ts_output_free(P_TS_OUTPUT pOutput)
+{
+    TS_OUTPUT* pTsOutput = (TS_OUTPUT*) pOutput;
+
+    if (pTsOutput)
+    {
+        if (pTsOutput->pFile)
+            fclose(pTsOutput->pFile);
+
+        OUT("TS output         : %u packets were written, %u dropped\n", pTsOutput->uPacketsNum, pTsOutput->uDroppedNum);
+
+        free(pTsOutput);
+    }
+}
+
+int ts_output_keep_pid(P_TS_OUTPUT pOutput, unsigned int uPID)
+{
+    TS_OUTPUT* pTsOutput = (TS_OUTPUT*) pOutput;
+
+    if ((! pTsOutput) || (uPID >= TS_PID_NUM))
+        return EXIT_FAILURE;
+
+    PID_BIT_SET(pTsOutput->pKeepMap, uPID);
+
+    return EXIT_SUCCESS;
+}
+
+int ts_output_parse_packets(P_TS_OUTPUT pOutput, unsigned char* pData, unsigned int uLength)
+{
+    TS_OUTPUT*     pTsOutput = (TS_OUTPUT*) pOutput;
+    unsigned char* pRunStart = pData;
+
+    if (! pTsOutput)
+        return EXIT_FAILURE;
+
+    for ( ; (uLength >= pTsOutput->uPacketSize) ; )
+    {
+        unsigned int   uPID       = ((pData[1] & 0x1F) << 8) | pData[2];
+        unsigned int   uKeep      = PID_BIT_GET(pTsOutput->pKeepMap, uPID);
+        unsigned char* pNewPacket = NULL;
+
+        if (pData[0] != TS_SYNC_CODE)
+        {
+            ERR("TS output : Sync byte was not found (0x%02X)\n", pData[0]);
+            return EXIT_FAILURE;
+        }
+
+        if ((pTsOutput->uRewritePSI) && (PID_BIT_GET(pTsOutput->pPmtMap, uPID)))
+        {
+            // PMTs from PAT are always parsed, the one without kept streams is dropped with its program
+            if (pData[1] & 0x40)
+                pNewPacket = _ts_output_rewrite_psi(pTsOutput, pData);
+
+            uKeep = ! PID_BIT_GET(pTsOutput->pEmptyMap, uPID);
+        }
+        else if ((uKeep) && (pTsOutput->uRewritePSI) && (pData[1] & 0x40) && (uPID == TS_PID_PAT))
+        {
+            pNewPacket = _ts_output_rewrite_psi(pTsOutput, pData);
+        }
+
+        if ((! uKeep) && (pTsOutput->uRewritePSI) && (PID_BIT_GET(pTsOutput->pPcrMap, uPID)))
+        {
+            pNewPacket = _ts_output_strip_pcr(pTsOutput, pData);
+            uKeep      = (pNewPacket != NULL);
+        }
+
+        if (! uKeep)
+        {
+            // Dropped packet ends the current run
+            if (_ts_output_write(pTsOutput, pRunStart, pData - pRunStart) != EXIT_SUCCESS)
+                return EXIT_FAILURE;
+
+            pRunStart = pData + pTsOutput->uPacketSize;
+            pTsOutput->uDroppedNum += 1;
+        }
+        else
+        {
+            if (pNewPacket)
+            {
+                // Rewritten packet replaces the original one in the run
+                if ((_ts_output_write(pTsOutput, pRunStart,  pData - pRunStart)     != EXIT_SUCCESS)
+                ||  (_ts_output_write(pTsOutput, pNewPacket, pTsOutput->uPacketSize) != EXIT_SUCCESS))
+                    return EXIT_FAILURE;
+
+                pRunStart = pData + pTsOutput->uPacketSize;
+            }
+
+            pTsOutput->uPacketsNum += 1;
+        }
+
+        uLength -= pTsOutput->uPacketSize;
+        pData   += pTsOutput->uPacketSize;
+    }
+
+    return _ts_output_write(pTsOutput, pRunStart, pData - pRunStart);
+}
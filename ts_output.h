@@ -0,0 +1,16 @@
+#ifndef __TS_OUTPUT_H__
+#define __TS_OUTPUT_H__
+
+typedef void* P_TS_OUTPUT;
+
+#define BAD_TS_OUTPUT ((P_TS_OUTPUT) NULL)
+
+P_TS_OUTPUT ts_output_create        (const char* pFileName, unsigned int uPacketSize, unsigned int uRewritePSI);
+void        ts_output_free          (P_TS_OUTPUT pOutput);
+
+int         ts_output_keep_pid      (P_TS_OUTPUT pOutput, unsigned int uPID);
+int         ts_output_parse_packets (P_TS_OUTPUT    pOutput,
+                                     unsigned char* pData,
+                                     unsigned int   uLength);
+
+#endif // __TS_OUTPUT_H__
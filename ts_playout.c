@@ -0,0 +1,353 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include "print_out.h"
+#include "ts_playout.h"
+
+#define PLAYOUT_PACKET_SIZE   188                // Datagrams carry plain 188-byte packets
+#define PLAYOUT_DGRAM_PACKETS 7                  // 7 * 188 bytes fit into Ethernet MTU
+#define PLAYOUT_BATCH_MAX     16
+#define PLAYOUT_BATCH_WINDOW  250000LLU          // Datagrams due within 250 us are sent at once
+#define PLAYOUT_LATE_LIMIT    1000000LLU         // 1 ms
+#define PLAYOUT_SOCKET_BUF    (1024 * 1024)
+
+#define UDP_PREFIX            "udp://"
+
+typedef struct _TS_PLAYOUT {
+    const char*        pTarget;
+    int                nFd;
+    unsigned int       uSocket;
+    unsigned int       uPacketSize;
+    unsigned int       uSendSize;
+    unsigned int       uDgramSize;
+
+    unsigned char*     pQueue;
+    unsigned int       uQueueLen;
+    unsigned long long pDue     [PLAYOUT_BATCH_MAX];
+    struct mmsghdr     pMessages[PLAYOUT_BATCH_MAX];
+    struct iovec       pVectors [PLAYOUT_BATCH_MAX];
+
+    unsigned long long lluStart;
+    unsigned long long lluDgramsNum;
+    unsigned long long lluBatchesNum;
+    unsigned long long lluJitterSum;
+    unsigned long long lluLateMax;
+    unsigned long long lluEarlyMax;
+    unsigned long long lluLateNum;
+} TS_PLAYOUT;
+
+// Original stdout kept for "-" target
+static int nPlayoutStdout = -1;
+
+static unsigned long long _ts_playout_now(void)
+{
+    struct timespec tNow;
+
+    clock_gettime(CLOCK_MONOTONIC, &tNow);
+
+    return (unsigned long long) tNow.tv_sec * 1000000000LLU + tNow.tv_nsec;
+}
+
+static void _ts_playout_sleep(unsigned long long lluTime)
+{
+    struct timespec tTime;
+
+    tTime.tv_sec  = lluTime / 1000000000LLU;
+    tTime.tv_nsec = lluTime % 1000000000LLU;
+
+    // Absolute deadline, so interrupted sleep is simply repeated
+    for ( ; (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &tTime, NULL) == EINTR) ; )
+        ;
+}
+
+static int _ts_playout_open_udp(const char* pAddress)
+{
+    struct sockaddr_in tAddr;
+    char               pHost[64];
+    const char*        pPort   = strrchr(pAddress, ':');
+    int                nSocket = -1;
+    int                nValue  = PLAYOUT_SOCKET_BUF;
+
+    // "udp://address:port"
+    if ((! pPort) || (pPort == pAddress) || ((unsigned int) (pPort - pAddress) >= sizeof(pHost)))
+        return -1;
+
+    memcpy(pHost, pAddress, pPort - pAddress);
+    pHost[pPort - pAddress] = '\0';
+
+    memset(&tAddr, 0, sizeof(tAddr));
+    tAddr.sin_family = AF_INET;
+    tAddr.sin_port   = htons((unsigned short) atoi(pPort + 1));
+
+    if (inet_pton(AF_INET, pHost, &tAddr.sin_addr) != 1)
+        return -1;
+
+    nSocket = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+
+    if (nSocket < 0)
+        return -1;
+
+    setsockopt(nSocket, SOL_SOCKET, SO_SNDBUF, &nValue, sizeof(nValue));
+
+    if (connect(nSocket, (struct sockaddr*) &tAddr, sizeof(tAddr)) < 0)
+    {
+        close(nSocket);
+        return -1;
+    }
+
+    return nSocket;
+}
+
+static int _ts_playout_write(TS_PLAYOUT* pTsPlayout, unsigned int uDgramsNum)
+{
+    unsigned int uSent = 0;
+    unsigned int i;
+
+    if (! pTsPlayout->uSocket)
+    {
+        // Pipe or file: the whole batch is one contiguous write
+        for ( ; (uSent < pTsPlayout->uQueueLen) ; )
+        {
+            ssize_t nWritten = write(pTsPlayout->nFd, pTsPlayout->pQueue + uSent, pTsPlayout->uQueueLen - uSent);
+
+            if ((nWritten < 0) && (errno == EINTR))
+                continue;
+
+            if (nWritten <= 0)
+                return EXIT_FAILURE;
+
+            uSent += nWritten;
+        }
+
+        return EXIT_SUCCESS;
+    }
+
+    // Socket: one datagram per queue slot, all sent by one system call
+    for (i = 0; i < uDgramsNum; i ++)
+    {
+        unsigned int uOffset = i * pTsPlayout->uDgramSize;
+        unsigned int uLength = pTsPlayout->uQueueLen - uOffset;
+
+        pTsPlayout->pVectors[i].iov_base = pTsPlayout->pQueue + uOffset;
+        pTsPlayout->pVectors[i].iov_len  = (uLength < pTsPlayout->uDgramSize) ? uLength : pTsPlayout->uDgramSize;
+
+        memset(&pTsPlayout->pMessages[i], 0, sizeof(struct mmsghdr));
+        pTsPlayout->pMessages[i].msg_hdr.msg_iov    = &pTsPlayout->pVectors[i];
+        pTsPlayout->pMessages[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    for ( ; (uSent < uDgramsNum) ; )
+    {
+        int nSent = sendmmsg(pTsPlayout->nFd, pTsPlayout->pMessages + uSent, uDgramsNum - uSent, 0);
+
+        if ((nSent < 0) && (errno == EINTR))
+            continue;
+
+        if (nSent <= 0)
+            return EXIT_FAILURE;
+
+        uSent += nSent;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+static int _ts_playout_send_queue(TS_PLAYOUT* pTsPlayout)
+{
+    unsigned int uDgramsNum = (pTsPlayout->uQueueLen + pTsPlayout->uDgramSize - 1) / pTsPlayout->uDgramSize;
+    unsigned int i;
+
+    if (! uDgramsNum)
+        return EXIT_SUCCESS;
+
+    // Batch is sent when its first datagram is due
+    _ts_playout_sleep(pTsPlayout->lluStart + pTsPlayout->pDue[0]);
+
+    if (_ts_playout_write(pTsPlayout, uDgramsNum) != EXIT_SUCCESS)
+    {
+        ERR("Cannot send data to \"%s\"\n", pTsPlayout->pTarget);
+        return EXIT_FAILURE;
+    }
+
+    // Output jitter: difference between actual and scheduled sending time of each datagram
+    unsigned long long lluNow = _ts_playout_now() - pTsPlayout->lluStart;
+
+    for (i = 0; i < uDgramsNum; i ++)
+    {
+        if (lluNow >= pTsPlayout->pDue[i])
+        {
+            unsigned long long lluLate = lluNow - pTsPlayout->pDue[i];
+
+            if (lluLate > pTsPlayout->lluLateMax) pTsPlayout->lluLateMax  = lluLate;
+            if (lluLate > PLAYOUT_LATE_LIMIT)     pTsPlayout->lluLateNum += 1;
+
+            pTsPlayout->lluJitterSum += lluLate;
+        }
+        else
+        {
+            unsigned long long lluEarly = pTsPlayout->pDue[i] - lluNow;
+
+            if (lluEarly > pTsPlayout->lluEarlyMax) pTsPlayout->lluEarlyMax = lluEarly;
+
+            pTsPlayout->lluJitterSum += lluEarly;
+        }
+    }
+
+    pTsPlayout->lluDgramsNum  += uDgramsNum;
+    pTsPlayout->lluBatchesNum += 1;
+    pTsPlayout->uQueueLen      = 0;
+
+    return EXIT_SUCCESS;
+}
+
+int ts_playout_stdout(void)
+{
+    // Stream takes stdout, all messages go to stderr from now on
+    if (nPlayoutStdout < 0)
+    {
+        fflush(stdout);
+
+        nPlayoutStdout = dup(STDOUT_FILENO);
+
+        if ((nPlayoutStdout >= 0) && (dup2(STDERR_FILENO, STDOUT_FILENO) < 0))
+        {
+            close(nPlayoutStdout);
+            nPlayoutStdout = -1;
+        }
+    }
+
+    return (nPlayoutStdout >= 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+P_TS_PLAYOUT ts_playout_create(const char* pTarget, unsigned int uPacketSize)
+{
+    if ((! pTarget) || (! uPacketSize))
+        return BAD_TS_PLAYOUT;
+
+    // Memory allocation for playout description struct and the queue of datagrams
+    TS_PLAYOUT* pTsPlayout = (TS_PLAYOUT*) calloc(1, sizeof(TS_PLAYOUT));
+
+    if (! pTsPlayout)
+        return BAD_TS_PLAYOUT;
+
+    // UDP receivers expect 188-byte packets, timestamps and parity bytes (192 and 204 bytes) are not sent
+    pTsPlayout->uSocket     = (! strncmp(pTarget, UDP_PREFIX, strlen(UDP_PREFIX)));
+    pTsPlayout->pTarget     = pTarget;
+    pTsPlayout->uPacketSize = uPacketSize;
+    pTsPlayout->uSendSize   = ((pTsPlayout->uSocket) && (uPacketSize > PLAYOUT_PACKET_SIZE)) ? PLAYOUT_PACKET_SIZE : uPacketSize;
+    pTsPlayout->uDgramSize  = pTsPlayout->uSendSize * PLAYOUT_DGRAM_PACKETS;
+    pTsPlayout->pQueue      = (unsigned char*) malloc(pTsPlayout->uDgramSize * PLAYOUT_BATCH_MAX);
+
+    if (! pTsPlayout->pQueue)
+    {
+        free(pTsPlayout);
+        return BAD_TS_PLAYOUT;
+    }
+
+    // UDP destination or anything that can be written: pipe, FIFO, file
+    if (pTsPlayout->uSocket)
+        pTsPlayout->nFd = _ts_playout_open_udp(pTarget + strlen(UDP_PREFIX));
+    else if (! strcmp(pTarget, "-"))
+        pTsPlayout->nFd = (ts_playout_stdout() == EXIT_SUCCESS) ? dup(nPlayoutStdout) : -1;
+    else
+        pTsPlayout->nFd = open(pTarget, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+
+    if (pTsPlayout->nFd < 0)
+    {
+        ERR("Cannot open playout target \"%s\"\n", pTarget);
+        free(pTsPlayout->pQueue);
+        free(pTsPlayout);
+        return BAD_TS_PLAYOUT;
+    }
+
+    OUT("Playout target    : \"%s\"\n", pTarget);
+
+    // Return the pointer to playout description struct
+    return (P_TS_PLAYOUT) pTsPlayout;
+}
+
+void ts_playout_free(P_TS_PLAYOUT pPlayout)
+{
+    TS_PLAYOUT* pTsPlayout = (TS_PLAYOUT*) pPlayout;
+
+    if (pTsPlayout)
+    {
+        if (pTsPlayout->lluDgramsNum > 0)
+        {
+            OUT("Playout           : %llu datagrams in %llu batches\n", pTsPlayout->lluDgramsNum, pTsPlayout->lluBatchesNum);
+            OUT("Playout jitter    : %llu us average, %llu us max late, %llu us max early, %llu late over %llu us\n",
+                pTsPlayout->lluJitterSum / pTsPlayout->lluDgramsNum / 1000,
+                pTsPlayout->lluLateMax  / 1000,
+                pTsPlayout->lluEarlyMax / 1000,
+                pTsPlayout->lluLateNum,
+                PLAYOUT_LATE_LIMIT / 1000);
+        }
+
+        close(pTsPlayout->nFd);
+
+        free(pTsPlayout->pQueue);
+        free(pTsPlayout);
+    }
+}
+
+int ts_playout_send(P_TS_PLAYOUT pPlayout, unsigned char* pPackets, unsigned int uPacketsNum, unsigned long long lluTime, unsigned long long lluStep)
+{
+    TS_PLAYOUT*  pTsPlayout = (TS_PLAYOUT*) pPlayout;
+    unsigned int i;
+
+    if (! pTsPlayout)
+        return EXIT_FAILURE;
+
+    // Playout clock starts with the first packet
+    if ((! pTsPlayout->lluStart) && (uPacketsNum > 0))
+        pTsPlayout->lluStart = _ts_playout_now() - lluTime;
+
+    // Packet i is due at lluTime + i * lluStep nanoseconds from the start
+    for (i = 0; i < uPacketsNum; i ++)
+    {
+        unsigned long long lluDue = lluTime + i * lluStep;
+
+        if (! (pTsPlayout->uQueueLen % pTsPlayout->uDgramSize))
+        {
+            unsigned int uDgram = pTsPlayout->uQueueLen / pTsPlayout->uDgramSize;
+
+            // New datagram: queued ones are sent first if the queue is full or they are due much earlier
+            if ((uDgram == PLAYOUT_BATCH_MAX)
+            || ((uDgram > 0) && ((lluDue - pTsPlayout->pDue[0]) > PLAYOUT_BATCH_WINDOW)))
+            {
+                if (_ts_playout_send_queue(pTsPlayout) != EXIT_SUCCESS)
+                    return EXIT_FAILURE;
+
+                uDgram = 0;
+            }
+
+            pTsPlayout->pDue[uDgram] = lluDue;
+        }
+
+        // Packets start with the sync byte, so the plain packet is always in front
+        memcpy(pTsPlayout->pQueue + pTsPlayout->uQueueLen, pPackets + i * pTsPlayout->uPacketSize, pTsPlayout->uSendSize);
+        pTsPlayout->uQueueLen += pTsPlayout->uSendSize;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+int ts_playout_flush(P_TS_PLAYOUT pPlayout)
+{
+    TS_PLAYOUT* pTsPlayout = (TS_PLAYOUT*) pPlayout;
+
+    if (! pTsPlayout)
+        return EXIT_FAILURE;
+
+    return _ts_playout_send_queue(pTsPlayout);
+}
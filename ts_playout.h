@@ -0,0 +1,20 @@
+#ifndef __TS_PLAYOUT_H__
+#define __TS_PLAYOUT_H__
+
+typedef void* P_TS_PLAYOUT;
+
+#define BAD_TS_PLAYOUT ((P_TS_PLAYOUT) NULL)
+
+int          ts_playout_stdout (void);
+
+P_TS_PLAYOUT ts_playout_create (const char* pTarget, unsigned int uPacketSize);
+void         ts_playout_free   (P_TS_PLAYOUT pPlayout);
+
+int          ts_playout_send   (P_TS_PLAYOUT       pPlayout,
+                                unsigned char*     pPackets,
+                                unsigned int       uPacketsNum,
+                                unsigned long long lluTime,
+                                unsigned long long lluStep);
+int          ts_playout_flush  (P_TS_PLAYOUT pPlayout);
+
+#endif // __TS_PLAYOUT_H__
@@ -0,0 +1,571 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+
+#include "print_out.h"
+#include "ts_demuxer.h"
+#include "ts_server.h"
+
+#define TS_PACKET_SIZE      188
+#define TS_SYNC_CODE        0x47
+
+#define SERVER_EVENTS_MAX   64
+#define SERVER_DGRAMS_MAX   32
+#define SERVER_DGRAM_SIZE   2048
+#define SERVER_READ_SIZE    (SERVER_DGRAMS_MAX * SERVER_DGRAM_SIZE)
+#define SERVER_READS_MAX    16
+#define SERVER_SOCKET_BUF   (2 * 1024 * 1024)
+
+#define UDP_PREFIX          "udp://"
+
+typedef enum _TS_CHANNEL_TYPE {
+    TS_CHANNEL_UDP = 0,
+    TS_CHANNEL_FIFO
+} TS_CHANNEL_TYPE;
+
+typedef struct _TS_CHANNEL {
+    char*              pInput;
+    char*              pVideoFileName;
+    char*              pAudioFileName;
+    TS_CHANNEL_TYPE    eType;
+    int                nFd;
+    P_TS_DEMUXER       pDemuxer;
+    unsigned char*     pCarry;
+    unsigned int       uCarryLen;
+    unsigned long long lluBytesNum;
+    unsigned long long lluDeadline;
+} TS_CHANNEL;
+
+typedef struct _TS_SERVER {
+    int                nEpollFd;
+    int                nSignalFd;
+    unsigned int       uChannelsMax;
+    unsigned int       uChannelsNum;
+    unsigned int       uActiveNum;
+    unsigned long long lluDeadline;   // The nearest flush deadline of all channels (ms)
+    TS_CHANNEL*        pChannels;
+    unsigned char*     pPool;
+    unsigned char*     pReadBuffer;
+    struct mmsghdr     pMessages[SERVER_DGRAMS_MAX];
+    struct iovec       pVectors [SERVER_DGRAMS_MAX];
+} TS_SERVER;
+
+static int _ts_server_open_udp(const char* pAddress)
+{
+    struct sockaddr_in tAddr;
+    char               pHost[64];
+    const char*        pPort   = strrchr(pAddress, ':');
+    int                nSocket = -1;
+    int                nValue  = 1;
+
+    // "udp://[address]:port", empty address means any interface
+    if ((! pPort) || ((unsigned int) (pPort - pAddress) >= sizeof(pHost)))
+        return -1;
+
+    memcpy(pHost, pAddress, pPort - pAddress);
+    pHost[pPort - pAddress] = '\0';
+
+    memset(&tAddr, 0, sizeof(tAddr));
+    tAddr.sin_family      = AF_INET;
+    tAddr.sin_port        = htons((unsigned short) atoi(pPort + 1));
+    tAddr.sin_addr.s_addr = htonl(INADDR_ANY);
+
+    if ((pHost[0]) && (inet_pton(AF_INET, pHost, &tAddr.sin_addr) != 1))
+        return -1;
+
+    nSocket = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+
+    if (nSocket < 0)
+        return -1;
+
+    setsockopt(nSocket, SOL_SOCKET, SO_REUSEADDR, &nValue, sizeof(nValue));
+
+    nValue = SERVER_SOCKET_BUF;
+    setsockopt(nSocket, SOL_SOCKET, SO_RCVBUF, &nValue, sizeof(nValue));
+
+    if (bind(nSocket, (struct sockaddr*) &tAddr, sizeof(tAddr)) < 0)
+    {
+        close(nSocket);
+        return -1;
+    }
+
+    // Multicast group is joined on default interface
+    if (IN_MULTICAST(ntohl(tAddr.sin_addr.s_addr)))
+    {
+        struct ip_mreq tRequest;
+
+        tRequest.imr_multiaddr        = tAddr.sin_addr;
+        tRequest.imr_interface.s_addr = htonl(INADDR_ANY);
+
+        if (setsockopt(nSocket, IPPROTO_IP, IP_ADD_MEMBERSHIP, &tRequest, sizeof(tRequest)) < 0)
+        {
+            close(nSocket);
+            return -1;
+        }
+    }
+
+    return nSocket;
+}
+
+static unsigned long long _ts_server_now_ms(void)
+{
+    struct timespec tNow;
+
+    clock_gettime(CLOCK_MONOTONIC, &tNow);
+
+    return (unsigned long long) tNow.tv_sec * 1000 + tNow.tv_nsec / 1000000;
+}
+
+static void _ts_server_poll_channel(TS_SERVER* pTsServer, TS_CHANNEL* pChannel, unsigned int uIdle, unsigned long long lluNow)
+{
+    unsigned int uTimeout = UINT_MAX;
+
+    if ((pChannel->nFd < 0) || (ts_demuxer_poll(pChannel->pDemuxer, uIdle, &uTimeout) != EXIT_SUCCESS))
+        uTimeout = UINT_MAX;
+
+    pChannel->lluDeadline = (uTimeout < UINT_MAX) ? lluNow + uTimeout : ULLONG_MAX;
+
+    if (pChannel->lluDeadline < pTsServer->lluDeadline)
+        pTsServer->lluDeadline = pChannel->lluDeadline;
+}
+
+static unsigned int _ts_server_poll(TS_SERVER* pTsServer, unsigned int uIdle)
+{
+    unsigned long long lluNow = _ts_server_now_ms();
+    unsigned int       i;
+
+    // Channels are walked only when the nearest deadline is reached, reads update deadlines of their own channels
+    if ((uIdle) || (lluNow >= pTsServer->lluDeadline))
+    {
+        pTsServer->lluDeadline = ULLONG_MAX;
+
+        for (i = 0; i < pTsServer->uChannelsNum; i ++)
+        {
+            TS_CHANNEL* pChannel = &pTsServer->pChannels[i];
+
+            if ((uIdle) || (pChannel->lluDeadline <= lluNow))
+                _ts_server_poll_channel(pTsServer, pChannel, uIdle, lluNow);
+            else if (pChannel->lluDeadline < pTsServer->lluDeadline)
+                pTsServer->lluDeadline = pChannel->lluDeadline;
+        }
+    }
+
+    return (pTsServer->lluDeadline < ULLONG_MAX) ? (unsigned int) (pTsServer->lluDeadline - lluNow) : UINT_MAX;
+}
+
+static void _ts_server_close_channel(TS_SERVER* pTsServer, TS_CHANNEL* pChannel)
+{
+    if (pChannel->nFd < 0)
+        return;
+
+    // Nothing more will come, buffered data is written out
+    ts_demuxer_poll(pChannel->pDemuxer, 1, NULL);
+
+    epoll_ctl(pTsServer->nEpollFd, EPOLL_CTL_DEL, pChannel->nFd, NULL);
+    close(pChannel->nFd);
+
+    pChannel->nFd = -1;
+    pTsServer->uActiveNum -= 1;
+
+    OUT("Channel \"%s\" is closed\n", pChannel->pInput);
+}
+
+static int _ts_server_read_udp(TS_SERVER* pTsServer, TS_CHANNEL* pChannel)
+{
+    unsigned int uReads;
+    int          i;
+
+    for (uReads = 0; uReads < SERVER_READS_MAX; uReads ++)
+    {
+        int nCount = recvmmsg(pChannel->nFd, pTsServer->pMessages, SERVER_DGRAMS_MAX, MSG_DONTWAIT, NULL);
+
+        if (nCount <= 0)
+            return ((nCount < 0) && (errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR)) ? EXIT_FAILURE : EXIT_SUCCESS;
+
+        for (i = 0; i < nCount; i ++)
+        {
+            unsigned char* pData   = (unsigned char*) pTsServer->pVectors[i].iov_base;
+            unsigned int   uLength = pTsServer->pMessages[i].msg_len;
+            unsigned int   uHeader = uLength % TS_PACKET_SIZE;
+
+            // Datagram carries whole packets, anything before them (e.g. RTP header) is skipped
+            if ((uHeader > 0) && (uHeader < uLength) && (pData[uHeader] == TS_SYNC_CODE))
+            {
+                pData   += uHeader;
+                uLength -= uHeader;
+            }
+
+            pChannel->lluBytesNum += uLength;
+
+            ts_demuxer_parse_data(pChannel->pDemuxer, pData, uLength, NULL);
+        }
+
+        if (nCount < SERVER_DGRAMS_MAX)
+            break;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+static int _ts_server_read_fifo(TS_SERVER* pTsServer, TS_CHANNEL* pChannel)
+{
+    unsigned int uReads;
+
+    for (uReads = 0; uReads < SERVER_READS_MAX; uReads ++)
+    {
+        // Incomplete packet from the previous read is put right before new data
+        unsigned char* pData = pTsServer->pReadBuffer - pChannel->uCarryLen;
+        ssize_t        nRead = read(pChannel->nFd, pTsServer->pReadBuffer, SERVER_READ_SIZE);
+        unsigned int   uRest = 0;
+
+        if (nRead == 0)
+            return EXIT_FAILURE;
+
+        if (nRead < 0)
+            return ((errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR)) ? EXIT_FAILURE : EXIT_SUCCESS;
+
+        memcpy(pData, pChannel->pCarry, pChannel->uCarryLen);
+
+        pChannel->lluBytesNum += nRead;
+
+        ts_demuxer_parse_data(pChannel->pDemuxer, pData, pChannel->uCarryLen + nRead, &uRest);
+
+        memcpy(pChannel->pCarry, pData + (pChannel->uCarryLen + nRead - uRest), uRest);
+        pChannel->uCarryLen = uRest;
+
+        if (nRead < SERVER_READ_SIZE)
+            break;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+static void _ts_server_report_latency(TS_CHANNEL* pChannel, ES_OUTPUT_TYPE eOutType)
+{
+    unsigned int uP50, uP90, uP99, uMax;
+
+    if (ts_demuxer_get_latency(pChannel->pDemuxer, eOutType, &uP50, &uP90, &uP99, &uMax) != EXIT_SUCCESS)
+        return;
+
+    OUT("    %s latency : p50 %u us, p90 %u us, p99 %u us, max %u us\n", es_output_type_str(eOutType), uP50, uP90, uP99, uMax);
+}
+
+static void _ts_server_report(TS_SERVER* pTsServer)
+{
+    unsigned int i;
+
+    OUT("----------------------------------------\n");
+
+    for (i = 0; i < pTsServer->uChannelsNum; i ++)
+    {
+        TS_CHANNEL*  pChannel    = &pTsServer->pChannels[i];
+        unsigned int uPacketsNum = 0;
+        unsigned int uErrorsNum  = 0;
+
+        ts_demuxer_get_stats(pChannel->pDemuxer, &uPacketsNum, &uErrorsNum);
+
+        OUT("Channel %u \"%s\": %llu bytes, %u packets, %u errors%s\n",
+            i,
+            pChannel->pInput,
+            pChannel->lluBytesNum,
+            uPacketsNum,
+            uErrorsNum,
+            (pChannel->nFd < 0) ? " (closed)" : "");
+
+        _ts_server_report_latency(pChannel, ES_OUTPUT_VIDEO);
+        _ts_server_report_latency(pChannel, ES_OUTPUT_AUDIO);
+    }
+
+    OUT("----------------------------------------\n");
+}
+
+P_TS_SERVER ts_server_create(unsigned int uChannelsMax)
+{
+    unsigned int i;
+
+    if (! uChannelsMax)
+        return BAD_TS_SERVER;
+
+    // Memory allocation for description struct and channels
+    TS_SERVER* pTsServer = (TS_SERVER*) calloc(1, sizeof(TS_SERVER));
+
+    if (! pTsServer)
+        return BAD_TS_SERVER;
+
+    pTsServer->nEpollFd     = -1;
+    pTsServer->nSignalFd    = -1;
+    pTsServer->uChannelsMax = uChannelsMax;
+    pTsServer->lluDeadline  = ULLONG_MAX;
+    pTsServer->pChannels    = (TS_CHANNEL*) calloc(uChannelsMax, sizeof(TS_CHANNEL));
+
+    // Shared buffer pool: one incomplete packet per channel and one read buffer for all channels.
+    // Read buffer has a room for incomplete packet in front of it.
+    pTsServer->pPool = (unsigned char*) malloc(uChannelsMax * TS_PACKET_SIZE + TS_PACKET_SIZE + SERVER_READ_SIZE);
+
+    if ((! pTsServer->pChannels) || (! pTsServer->pPool))
+    {
+        ts_server_free((P_TS_SERVER) pTsServer);
+        return BAD_TS_SERVER;
+    }
+
+    pTsServer->pReadBuffer = pTsServer->pPool + (uChannelsMax + 1) * TS_PACKET_SIZE;
+
+    for (i = 0; i < SERVER_DGRAMS_MAX; i ++)
+    {
+        pTsServer->pVectors[i].iov_base = pTsServer->pReadBuffer + i * SERVER_DGRAM_SIZE;
+        pTsServer->pVectors[i].iov_len  = SERVER_DGRAM_SIZE;
+
+        pTsServer->pMessages[i].msg_hdr.msg_iov    = &pTsServer->pVectors[i];
+        pTsServer->pMessages[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    pTsServer->nEpollFd = epoll_create1(EPOLL_CLOEXEC);
+
+    if (pTsServer->nEpollFd < 0)
+    {
+        ts_server_free((P_TS_SERVER) pTsServer);
+        return BAD_TS_SERVER;
+    }
+
+    // Return the pointer to description struct
+    return (P_TS_SERVER) pTsServer;
+}
+
+void ts_server_free(P_TS_SERVER pServer)
+{
+    TS_SERVER*   pTsServer = (TS_SERVER*) pServer;
+    unsigned int i;
+
+    if (pTsServer)
+    {
+        for (i = 0; i < pTsServer->uChannelsNum; i ++)
+        {
+            TS_CHANNEL* pChannel = &pTsServer->pChannels[i];
+
+            _ts_server_close_channel(pTsServer, pChannel);
+
+            if (pChannel->pDemuxer != BAD_TS_DEMUXER)
+                ts_demuxer_free(pChannel->pDemuxer);
+
+            free(pChannel->pInput);
+            free(pChannel->pVideoFileName);
+            free(pChannel->pAudioFileName);
+        }
+
+        if (pTsServer->nSignalFd >= 0)
+            close(pTsServer->nSignalFd);
+
+        if (pTsServer->nEpollFd >= 0)
+            close(pTsServer->nEpollFd);
+
+        free(pTsServer->pChannels);
+        free(pTsServer->pPool);
+        free(pTsServer);
+    }
+}
+
+int ts_server_add_channel(P_TS_SERVER            pServer,
+                          const char*            pInput,
+                          const char*            pVideoFileName,
+                          const char*            pAudioFileName,
+                          const ES_FLUSH_POLICY* pFlush,
+                          const unsigned int*    pFlushValue)
+{
+    TS_SERVER*         pTsServer = (TS_SERVER*) pServer;
+    TS_CHANNEL*        pChannel  = NULL;
+    struct epoll_event tEvent;
+
+    if ((! pTsServer) || (! pInput))
+        return EXIT_FAILURE;
+
+    if (pTsServer->uChannelsNum >= pTsServer->uChannelsMax)
+    {
+        ERR("Too many channels (%u)\n", pTsServer->uChannelsMax);
+        return EXIT_FAILURE;
+    }
+
+    // Names are kept by the channel, outputs open their files on the first write
+    pChannel = &pTsServer->pChannels[pTsServer->uChannelsNum];
+    pChannel->pInput         = strdup(pInput);
+    pChannel->pVideoFileName = pVideoFileName ? strdup(pVideoFileName) : NULL;
+    pChannel->pAudioFileName = pAudioFileName ? strdup(pAudioFileName) : NULL;
+    pChannel->nFd            = -1;
+    pChannel->pCarry         = pTsServer->pPool + pTsServer->uChannelsNum * TS_PACKET_SIZE;
+    pChannel->uCarryLen      = 0;
+    pChannel->lluBytesNum    = 0;
+    pChannel->lluDeadline    = ULLONG_MAX;
+    pChannel->pDemuxer       = BAD_TS_DEMUXER;
+
+    pTsServer->uChannelsNum += 1;
+
+    if ((! pChannel->pInput)
+    || ((pVideoFileName) && (! pChannel->pVideoFileName))
+    || ((pAudioFileName) && (! pChannel->pAudioFileName)))
+        return EXIT_FAILURE;
+
+    pChannel->pDemuxer = ts_demuxer_create_live(pChannel->pInput);
+
+    if ((pChannel->pDemuxer == BAD_TS_DEMUXER)
+    ||  (ts_demuxer_set_flush(pChannel->pDemuxer, ES_OUTPUT_VIDEO, pFlush[ES_OUTPUT_VIDEO], pFlushValue[ES_OUTPUT_VIDEO]) != EXIT_SUCCESS)
+    ||  (ts_demuxer_set_flush(pChannel->pDemuxer, ES_OUTPUT_AUDIO, pFlush[ES_OUTPUT_AUDIO], pFlushValue[ES_OUTPUT_AUDIO]) != EXIT_SUCCESS)
+    || ((pChannel->pVideoFileName) && (ts_demuxer_add_output(pChannel->pDemuxer, ES_OUTPUT_VIDEO, pChannel->pVideoFileName) != EXIT_SUCCESS))
+    || ((pChannel->pAudioFileName) && (ts_demuxer_add_output(pChannel->pDemuxer, ES_OUTPUT_AUDIO, pChannel->pAudioFileName) != EXIT_SUCCESS)))
+        return EXIT_FAILURE;
+
+    // Input: UDP socket or anything else which can be opened for reading (FIFO, character device)
+    if (! strncmp(pInput, UDP_PREFIX, strlen(UDP_PREFIX)))
+    {
+        pChannel->eType = TS_CHANNEL_UDP;
+        pChannel->nFd   = _ts_server_open_udp(pInput + strlen(UDP_PREFIX));
+    }
+    else
+    {
+        pChannel->eType = TS_CHANNEL_FIFO;
+        pChannel->nFd   = open(pInput, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    }
+
+    if (pChannel->nFd < 0)
+    {
+        ERR("Cannot open input \"%s\"\n", pInput);
+        return EXIT_FAILURE;
+    }
+
+    tEvent.events   = EPOLLIN;
+    tEvent.data.ptr = pChannel;
+
+    if (epoll_ctl(pTsServer->nEpollFd, EPOLL_CTL_ADD, pChannel->nFd, &tEvent) < 0)
+    {
+        close(pChannel->nFd);
+        pChannel->nFd = -1;
+        return EXIT_FAILURE;
+    }
+
+    pTsServer->uActiveNum += 1;
+
+    return EXIT_SUCCESS;
+}
+
+int ts_server_run(P_TS_SERVER pServer, unsigned int uIdleTimeout)
+{
+    TS_SERVER*         pTsServer = (TS_SERVER*) pServer;
+    struct epoll_event pEvents[SERVER_EVENTS_MAX];
+    struct epoll_event tEvent;
+    sigset_t           tSignals;
+    int                nResult   = EXIT_SUCCESS;
+    unsigned int       uStop     = 0;
+    unsigned long long lluActive = 0;
+    int                i;
+
+    if (! pTsServer)
+        return EXIT_FAILURE;
+
+    // Signals are delivered through the loop: SIGUSR1 prints statistics, SIGINT and SIGTERM stop the server
+    sigemptyset(&tSignals);
+    sigaddset(&tSignals, SIGINT);
+    sigaddset(&tSignals, SIGTERM);
+    sigaddset(&tSignals, SIGUSR1);
+
+    if ((sigprocmask(SIG_BLOCK, &tSignals, NULL) < 0)
+    || ((pTsServer->nSignalFd = signalfd(-1, &tSignals, SFD_NONBLOCK | SFD_CLOEXEC)) < 0))
+        return EXIT_FAILURE;
+
+    tEvent.events   = EPOLLIN;
+    tEvent.data.ptr = NULL;
+
+    if (epoll_ctl(pTsServer->nEpollFd, EPOLL_CTL_ADD, pTsServer->nSignalFd, &tEvent) < 0)
+        return EXIT_FAILURE;
+
+    OUT("Server            : %u channels, %u ms idle timeout\n", pTsServer->uChannelsNum, uIdleTimeout);
+
+    lluActive = _ts_server_now_ms();
+
+    for ( ; (! uStop) && (pTsServer->uActiveNum > 0) ; )
+    {
+        // Wait until the nearest flush deadline or the end of idle timeout
+        unsigned int       uTimeout = _ts_server_poll(pTsServer, 0);
+        unsigned long long lluIdle  = _ts_server_now_ms() - lluActive;
+        unsigned int       uLeft    = (lluIdle < uIdleTimeout) ? uIdleTimeout - (unsigned int) lluIdle : 0;
+
+        if ((uIdleTimeout) && (uLeft < uTimeout))
+            uTimeout = uLeft;
+
+        int nCount = epoll_wait(pTsServer->nEpollFd, pEvents, SERVER_EVENTS_MAX, (uTimeout < INT_MAX) ? (int) uTimeout : -1);
+
+        if ((nCount < 0) && (errno == EINTR))
+            continue;
+
+        if (nCount < 0)
+        {
+            nResult = EXIT_FAILURE;
+            break;
+        }
+
+        if (nCount == 0)
+        {
+            // Flush deadline was reached, it is handled at the top of the loop.
+            // Other policies keep their data until the whole idle timeout passes.
+            if ((uIdleTimeout) && (_ts_server_now_ms() - lluActive >= uIdleTimeout))
+            {
+                _ts_server_poll(pTsServer, 1);
+
+                OUT("All inputs were idle for %u ms\n", uIdleTimeout);
+                break;
+            }
+
+            continue;
+        }
+
+        for (i = 0; i < nCount; i ++)
+        {
+            TS_CHANNEL* pChannel = (TS_CHANNEL*) pEvents[i].data.ptr;
+
+            if (! pChannel)
+            {
+                struct signalfd_siginfo tInfo;
+
+                if (read(pTsServer->nSignalFd, &tInfo, sizeof(tInfo)) != sizeof(tInfo))
+                    continue;
+
+                if (tInfo.ssi_signo == SIGUSR1)
+                {
+                    _ts_server_report(pTsServer);
+                    continue;
+                }
+
+                OUT("Server is stopped by signal %u\n", tInfo.ssi_signo);
+                uStop = 1;
+                break;
+            }
+
+            if (pChannel->nFd < 0)
+                continue;
+
+            lluActive = _ts_server_now_ms();
+
+            if (((pChannel->eType == TS_CHANNEL_UDP)  && (_ts_server_read_udp (pTsServer, pChannel) != EXIT_SUCCESS))
+            ||  ((pChannel->eType == TS_CHANNEL_FIFO) && (_ts_server_read_fifo(pTsServer, pChannel) != EXIT_SUCCESS)))
+                _ts_server_close_channel(pTsServer, pChannel);
+
+            // New data may start a new deadline
+            _ts_server_poll_channel(pTsServer, pChannel, 0, _ts_server_now_ms());
+        }
+    }
+
+    _ts_server_report(pTsServer);
+
+    sigprocmask(SIG_UNBLOCK, &tSignals, NULL);
+    return nResult;
+}
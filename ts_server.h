@@ -0,0 +1,21 @@
+#ifndef __TS_SERVER_H__
+#define __TS_SERVER_H__
+
+#include "es_output.h"
+
+typedef void* P_TS_SERVER;
+
+#define BAD_TS_SERVER ((P_TS_SERVER) NULL)
+
+P_TS_SERVER ts_server_create      (unsigned int uChannelsMax);
+void        ts_server_free        (P_TS_SERVER pServer);
+
+int         ts_server_add_channel (P_TS_SERVER            pServer,
+                                   const char*            pInput,
+                                   const char*            pVideoFileName,
+                                   const char*            pAudioFileName,
+                                   const ES_FLUSH_POLICY* pFlush,
+                                   const unsigned int*    pFlushValue);
+int         ts_server_run         (P_TS_SERVER pServer, unsigned int uIdleTimeout);
+
+#endif // __TS_SERVER_H__